@@ -26,71 +26,77 @@
 #include "bcm2835_gpio.h"
 #include "gpio.h"
 
-int bcm2711_gpio_set_pull_bits(gpio_t *gpio, uint64_t pins,
-                               pull_control_t value) {
-  volatile uint32_t *base = ((bcm2711_gpio_ext_t *)gpio->ext)->base;
-
-  int v;
-
+/**
+ * Convert a pull control value to the BCM2711 pull-up/down field value.
+ *
+ * @param value the pull control value.
+ * @return the two bit GPIO_PUP_PDN_CNTRL field value.
+ */
+static uint32_t bcm2711_pull_field(pull_control_t value) {
   // Note: the bits for UP and DOWN differ from the BCM2835.
   switch (value) {
-  case OFF:
-    v = 0;
-    break;
   case UP:
-    v = 1;
-    break;
+    return 1;
   case DOWN:
-    v = 2;
-    break;
+    return 2;
+  default:
+    return 0;
   }
+}
 
-  for (int reg = 0; reg < 3; reg++) {
-    uint32_t reg_value = 0;
-    for (int i = 0; i < 16; i++) {
-      if ((pins & (1 << i)) != 0) {
-        reg_value = (reg_value & ~(3 << (i << 1))) | (v << (i << 1));
-      }
+/**
+ * Write the GPIO_PUP_PDN_CNTRL registers whose values differ from the shadow,
+ * and update the shadow.
+ *
+ * @param ext the BCM2711 extension structure.
+ * @param pup_pdn_cntrl the new register values.
+ */
+static void bcm2711_gpio_write_pup_pdn_cntrl(bcm2711_gpio_ext_t *ext,
+                                             uint32_t pup_pdn_cntrl[4]) {
+  for (int reg = 0; reg < 4; reg++) {
+    if (pup_pdn_cntrl[reg] != ext->pup_pdn_cntrl[reg]) {
+      *(ext->base + GPIO_PUP_PDN_CNTRL_REG0 + reg) = pup_pdn_cntrl[reg];
+      ext->pup_pdn_cntrl[reg] = pup_pdn_cntrl[reg];
     }
-    *(base + GPIO_PUP_PDN_CNTRL_REG0 + reg) = reg_value;
+  }
+}
+
+int bcm2711_gpio_set_pull_bits(gpio_t *gpio, uint64_t pins,
+                               pull_control_t value) {
+  bcm2711_gpio_ext_t *ext = (bcm2711_gpio_ext_t *)gpio->ext;
+
+  if (pins & 0xfc00000000000000) {
+    return GPIO_ERR_INVALID_PIN;
   }
 
-  // Check bits 48-57 for CNTRL_REG3
-  if ((pins & (0x03ff000000000000)) != 0) {
-    uint64_t p = pins >> 48;
-    uint32_t reg_value = 0;
-    for (int i = 0; i < 10; i++) {
-      if ((p & (1 << i)) != 0) {
-        reg_value = (reg_value & ~(3 << (i << 1))) | (v << (i << 1));
+  uint32_t v = bcm2711_pull_field(value);
+  uint32_t pup_pdn_cntrl[4];
+  for (int reg = 0; reg < 4; reg++) {
+    pup_pdn_cntrl[reg] = ext->pup_pdn_cntrl[reg];
+
+    // Each register handles sixteen pins.
+    for (int i = 0; i < 16; i++) {
+      if ((pins & ((uint64_t)1 << (reg * 16 + i))) != 0) {
+        int shift = i << 1;
+        pup_pdn_cntrl[reg] =
+            (pup_pdn_cntrl[reg] & ~(0x3 << shift)) | (v << shift);
       }
     }
-    *(base + GPIO_PUP_PDN_CNTRL_REG3) = reg_value;
   }
+  bcm2711_gpio_write_pup_pdn_cntrl(ext, pup_pdn_cntrl);
+
   return GPIO_SUCCESS;
 }
 
 int bcm2711_gpio_set_pull_pins(gpio_t *gpio, pin_t *pins, size_t n,
                                pull_control_t value) {
-  volatile uint32_t *base = ((bcm2711_gpio_ext_t *)gpio->ext)->base;
+  bcm2711_gpio_ext_t *ext = (bcm2711_gpio_ext_t *)gpio->ext;
 
   uint32_t gpio_pup_pdn_cntrl[4] = {
-      *(base + GPIO_PUP_PDN_CNTRL_REG0), *(base + GPIO_PUP_PDN_CNTRL_REG1),
-      *(base + GPIO_PUP_PDN_CNTRL_REG2), *(base + GPIO_PUP_PDN_CNTRL_REG3)};
+      ext->pup_pdn_cntrl[0], ext->pup_pdn_cntrl[1], ext->pup_pdn_cntrl[2],
+      ext->pup_pdn_cntrl[3]};
 
-  int v;
-
-  // Note: the bits for UP and DOWN differ from the BCM2835.
-  switch (value) {
-  case OFF:
-    v = 0;
-    break;
-  case UP:
-    v = 1;
-    break;
-  case DOWN:
-    v = 2;
-    break;
-  }
+  uint32_t v = bcm2711_pull_field(value);
 
   for (int i = 0; i < n; i++) {
     if (pins[i] <= 57) {
@@ -102,11 +108,7 @@ int bcm2711_gpio_set_pull_pins(gpio_t *gpio, pin_t *pins, size_t n,
       return GPIO_ERR_INVALID_PIN;
     }
   }
-
-  *(base + GPIO_PUP_PDN_CNTRL_REG0) = gpio_pup_pdn_cntrl[0];
-  *(base + GPIO_PUP_PDN_CNTRL_REG1) = gpio_pup_pdn_cntrl[1];
-  *(base + GPIO_PUP_PDN_CNTRL_REG2) = gpio_pup_pdn_cntrl[2];
-  *(base + GPIO_PUP_PDN_CNTRL_REG3) = gpio_pup_pdn_cntrl[3];
+  bcm2711_gpio_write_pup_pdn_cntrl(ext, gpio_pup_pdn_cntrl);
 
   return GPIO_SUCCESS;
 }
@@ -124,8 +126,23 @@ int bcm2711_gpio_init(gpio_t *gpio, bcm2711_gpio_ext_t *ext) {
   gpio->set_pull_bits = bcm2711_gpio_set_pull_bits;
   gpio->set_pins = bcm2835_gpio_set_pins;
   gpio->set_bits = bcm2835_gpio_set_bits;
+  gpio->write_masked = bcm2835_gpio_write_masked;
+  gpio->get_pins = bcm2835_gpio_get_pins;
+  gpio->get_bits = bcm2835_gpio_get_bits;
+  gpio->set_enable_event_detect_bits =
+      bcm2835_gpio_set_enable_event_detect_bits;
+  gpio->clear_enable_event_detect_bits =
+      bcm2835_gpio_clear_enable_event_detect_bits;
+  gpio->get_and_clear_events = bcm2835_gpio_get_and_clear_events;
 
   gpio->ext = ext;
 
+  for (int reg = 0; reg < 6; reg++) {
+    ext->gpfsel[reg] = *(ext->base + GPFSEL0 + reg);
+  }
+  for (int reg = 0; reg < 4; reg++) {
+    ext->pup_pdn_cntrl[reg] = *(ext->base + GPIO_PUP_PDN_CNTRL_REG0 + reg);
+  }
+
   return GPIO_SUCCESS;
 }
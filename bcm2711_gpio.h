@@ -59,4 +59,33 @@ int bcm2711_gpio_set_pull_pins(gpio_t *gpio, pin_t *pins, size_t n,
                                pull_control_t value);
 
 int bcm2711_gpio_init(gpio_t *gpio, bcm2711_gpio_ext_t *ext);
+
+/*
+ * Everything but pull control is the same as the BCM2835. These give the
+ * shared operations BCM2711 names, for builds with GPIO_BACKEND=bcm2711.
+ */
+static inline int bcm2711_gpio_set_function_pins(gpio_t *gpio, pin_t *pins,
+                                                 size_t n,
+                                                 pin_function_t value) {
+  return bcm2835_gpio_set_function_pins(gpio, pins, n, value);
+}
+
+static inline int bcm2711_gpio_set_pins(gpio_t *gpio, pin_t *pins, size_t n,
+                                        char value) {
+  return bcm2835_gpio_set_pins(gpio, pins, n, value);
+}
+
+static inline int bcm2711_gpio_set_bits(gpio_t *gpio, uint64_t pins,
+                                        char value) {
+  return bcm2835_gpio_set_bits(gpio, pins, value);
+}
+
+static inline int bcm2711_gpio_write_masked(gpio_t *gpio, uint64_t set_pins,
+                                            uint64_t clear_pins) {
+  return bcm2835_gpio_write_masked(gpio, set_pins, clear_pins);
+}
+
+static inline int bcm2711_gpio_get_bits(gpio_t *gpio, uint64_t *values) {
+  return bcm2835_gpio_get_bits(gpio, values);
+}
 #endif
@@ -28,55 +28,56 @@
 
 int bcm2835_gpio_close(gpio_t *gpio) { return GPIO_SUCCESS; }
 
+/**
+ * Write the GPFSEL registers whose values differ from the shadow, and update
+ * the shadow.
+ *
+ * @param ext the BCM2835 extension structure.
+ * @param gpfsel the new GPFSEL register values.
+ */
+static void bcm2835_gpio_write_gpfsel(bcm2835_gpio_ext_t *ext,
+                                      uint32_t gpfsel[6]) {
+  for (int reg = 0; reg < 6; reg++) {
+    if (gpfsel[reg] != ext->gpfsel[reg]) {
+      *(ext->base + GPFSEL0 + reg) = gpfsel[reg];
+      ext->gpfsel[reg] = gpfsel[reg];
+    }
+  }
+}
+
 int bcm2835_gpio_set_function_bits(gpio_t *gpio, uint64_t pins,
                                    pin_function_t value) {
-  volatile uint32_t *base = ((bcm2835_gpio_ext_t *)gpio->ext)->base;
+  bcm2835_gpio_ext_t *ext = (bcm2835_gpio_ext_t *)gpio->ext;
 
   if (pins & 0xffc0000000000000) {
     return GPIO_ERR_INVALID_PIN;
   }
 
-  // handle first four GPFSEL registers.
-  for (int gpfsel = 0; gpfsel < 5; gpfsel++) {
+  uint32_t gpfsel[6];
+  for (int reg = 0; reg < 6; reg++) {
+    gpfsel[reg] = ext->gpfsel[reg];
 
-    // Check ten bits at a time- GPFSEL0-4 each handle ten pins.
-    if ((pins & 0x3ff) != 0) {
-      uint32_t reg_value = 0;
-
-      // If the bit is set, OR the function code to the register value.
-      for (int i = 0; i < 10; i++) {
-        if ((pins & (1 << i)) != 0) {
-          reg_value |= value << (i * 3);
-        }
-      }
-
-      *(base + GPFSEL0 + gpfsel) = reg_value;
-    }
-
-    pins = pins >> 10;
-  }
+    // Each GPFSEL register handles ten pins.
+    for (int i = 0; i < 10; i++) {
+      if ((pins & ((uint64_t)1 << (reg * 10 + i))) != 0) {
+        int shift = i * 3;
+        int v = value & 0x7;
 
-  // Check bits 50-53, and set GPFSEL5 accordingly.
-  if ((pins & 0xf) != 0) {
-    uint32_t reg_value = 0;
-    for (int i = 0; i < 4; i++) {
-      if ((pins & (1 << i)) != 0) {
-        reg_value |= value << (i * 3);
+        gpfsel[reg] = (gpfsel[reg] & ~(0x7 << shift)) | (v << shift);
       }
     }
-    *(base + GPFSEL5) = reg_value;
   }
+  bcm2835_gpio_write_gpfsel(ext, gpfsel);
 
   return GPIO_SUCCESS;
 };
 
 int bcm2835_gpio_set_function_pins(gpio_t *gpio, pin_t *pins, size_t n,
                                    pin_function_t value) {
-  volatile uint32_t *base = ((bcm2835_gpio_ext_t *)gpio->ext)->base;
+  bcm2835_gpio_ext_t *ext = (bcm2835_gpio_ext_t *)gpio->ext;
 
-  uint32_t gpfsel[6] = {*(base + GPFSEL0), *(base + GPFSEL1),
-                        *(base + GPFSEL2), *(base + GPFSEL3),
-                        *(base + GPFSEL4), *(base + GPFSEL5)};
+  uint32_t gpfsel[6] = {ext->gpfsel[0], ext->gpfsel[1], ext->gpfsel[2],
+                        ext->gpfsel[3], ext->gpfsel[4], ext->gpfsel[5]};
 
   for (int i = 0; i < n; i++) {
     int pin = pins[i];
@@ -90,27 +91,21 @@ int bcm2835_gpio_set_function_pins(gpio_t *gpio, pin_t *pins, size_t n,
       return GPIO_ERR_INVALID_PIN; // bcm2835 has 54 GPIO pins.
     }
   }
-
-  *(base + GPFSEL0) = gpfsel[0];
-  *(base + GPFSEL1) = gpfsel[1];
-  *(base + GPFSEL2) = gpfsel[2];
-  *(base + GPFSEL3) = gpfsel[3];
-  *(base + GPFSEL4) = gpfsel[4];
-  *(base + GPFSEL5) = gpfsel[5];
+  bcm2835_gpio_write_gpfsel(ext, gpfsel);
 
   return GPIO_SUCCESS;
 }
 
 int bcm2835_gpio_get_function_pins(gpio_t *gpio, pin_t *pins,
                                    pin_function_t *values, size_t n) {
-  volatile uint32_t *base = ((bcm2835_gpio_ext_t *)gpio->ext)->base;
+  bcm2835_gpio_ext_t *ext = (bcm2835_gpio_ext_t *)gpio->ext;
 
   for (int i = 0; i < n; i++) {
     if (pins[i] < 54) {
       int reg = pins[i] / 10;
       int bit = pins[i] % 10;
 
-      values[i] = (*(base + GPFSEL0 + reg) >> (bit * 3)) & 0x7;
+      values[i] = (ext->gpfsel[reg] >> (bit * 3)) & 0x7;
     } else {
       return GPIO_ERR_INVALID_PIN;
     }
@@ -139,6 +134,29 @@ int bcm2835_gpio_set_pins(gpio_t *gpio, pin_t *pins, size_t n, char value) {
   return bcm2835_gpio_set_bits(gpio, pins_to_bits(pins, n), value);
 }
 
+int bcm2835_gpio_write_masked(gpio_t *gpio, uint64_t set_pins,
+                              uint64_t clear_pins) {
+  volatile uint32_t *base = ((bcm2835_gpio_ext_t *)gpio->ext)->base;
+
+  if (((set_pins | clear_pins) & 0xffc0000000000000) != 0) {
+    return GPIO_ERR_INVALID_PIN;
+  }
+  if ((uint32_t)set_pins != 0) {
+    *(base + GPSET0) = set_pins;
+  }
+  if ((set_pins >> 32) != 0) {
+    *(base + GPSET1) = set_pins >> 32;
+  }
+  if ((uint32_t)clear_pins != 0) {
+    *(base + GPCLR0) = clear_pins;
+  }
+  if ((clear_pins >> 32) != 0) {
+    *(base + GPCLR1) = clear_pins >> 32;
+  }
+
+  return GPIO_SUCCESS;
+}
+
 int bcm2835_gpio_get_bits(gpio_t *gpio, uint64_t *pins) {
   volatile uint32_t *base = ((bcm2835_gpio_ext_t *)gpio->ext)->base;
   *pins = *(base + GPLEV0) | ((uint64_t)(*(base + GPLEV1) & 0x001fffff) << 32);
@@ -164,13 +182,20 @@ int bcm2835_gpio_get_pins(gpio_t *gpio, pin_t *pins, char *values, size_t n) {
   return GPIO_SUCCESS;
 }
 
-// get the GPEDSn values.  Set all 54 GPEDSn bits to clear them.
-// TODO: maybe have a mask param?
+// Get the GPEDSn values, and clear just the events that were read, so an
+// event that arrives in between is not lost.
 int bcm2835_gpio_get_and_clear_events(gpio_t *gpio, uint64_t *values) {
   volatile uint32_t *base = ((bcm2835_gpio_ext_t *)gpio->ext)->base;
-  *values = ((uint64_t) * (base + GPEDS1) << 32) | *(base + GPEDS0);
-  *(base + GPEDS1) = 0x003fffff;
-  *(base + GPEDS0) = 0xffffffff;
+  uint32_t events0 = *(base + GPEDS0);
+  uint32_t events1 = *(base + GPEDS1);
+
+  if (events0 != 0) {
+    *(base + GPEDS0) = events0;
+  }
+  if (events1 != 0) {
+    *(base + GPEDS1) = events1;
+  }
+  *values = ((uint64_t)events1 << 32) | events0;
 
   return GPIO_SUCCESS;
 }
@@ -273,7 +298,7 @@ int bcm2835_gpio_get_enable_event_detect_pins(gpio_t *gpio, pin_t *pins,
     if (pins[i] > 53) {
       return GPIO_ERR_INVALID_PIN;
     }
-    uint64_t mask = 1 << pins[i];
+    uint64_t mask = (uint64_t)1 << pins[i];
     detection_type_t value = 0;
     if (gpren & mask) {
       value |= DETECT_RISING;
@@ -301,7 +326,31 @@ int bcm2835_gpio_get_enable_event_detect_pins(gpio_t *gpio, pin_t *pins,
 
 int bcm2835_gpio_set_pull_bits(gpio_t *gpio, uint64_t pins,
                                pull_control_t value) {
-  volatile uint32_t *base = ((bcm2835_gpio_ext_t *)gpio->ext)->base;
+  bcm2835_gpio_ext_t *ext = (bcm2835_gpio_ext_t *)gpio->ext;
+  volatile uint32_t *base = ext->base;
+
+  if (pins & 0xffc0000000000000) {
+    return GPIO_ERR_INVALID_PIN;
+  }
+
+  // Skip the pins that already have this pull applied.
+  uint64_t same;
+  switch (value) {
+  case UP:
+    same = ext->pull_up;
+    break;
+  case DOWN:
+    same = ext->pull_down;
+    break;
+  default:
+    same = ext->pull_known & ~(ext->pull_up | ext->pull_down);
+    break;
+  }
+  pins &= ~same;
+  if (pins == 0) {
+    return GPIO_SUCCESS;
+  }
+
   /*
    * The sequence to set internal pullup/pulldown resistors is
    *
@@ -314,20 +363,29 @@ int bcm2835_gpio_set_pull_bits(gpio_t *gpio, uint64_t pins,
    *   7. Zero the pull up/down clock.
    *   8. Wait 150 cycles.
    */
-  if (pins & 0xffc0000000000000) {
-    return GPIO_ERR_INVALID_PIN;
-  }
   *(base + GPPUD) = value;
   usleep(10); // from raspi-gpio
-  *(base + GPPUDCLK0) = pins;
-  *(base + GPPUDCLK1) = pins >> 32;
+  if ((uint32_t)pins != 0) {
+    *(base + GPPUDCLK0) = pins;
+  }
+  if ((pins >> 32) != 0) {
+    *(base + GPPUDCLK1) = pins >> 32;
+  }
   usleep(10);
   *(base + GPPUD) = OFF;
   usleep(10);
-  *(base + GPPUDCLK0) = 0;
-  *(base + GPPUDCLK1) = 0;
+  if ((uint32_t)pins != 0) {
+    *(base + GPPUDCLK0) = 0;
+  }
+  if ((pins >> 32) != 0) {
+    *(base + GPPUDCLK1) = 0;
+  }
   usleep(10);
 
+  ext->pull_known |= pins;
+  ext->pull_up = (ext->pull_up & ~pins) | (value == UP ? pins : 0);
+  ext->pull_down = (ext->pull_down & ~pins) | (value == DOWN ? pins : 0);
+
   return GPIO_SUCCESS;
 };
 
@@ -348,10 +406,23 @@ int bcm2835_gpio_init(gpio_t *gpio, bcm2835_gpio_ext_t *ext) {
   gpio->set_pull_bits = bcm2835_gpio_set_pull_bits;
   gpio->set_pins = bcm2835_gpio_set_pins;
   gpio->set_bits = bcm2835_gpio_set_bits;
+  gpio->write_masked = bcm2835_gpio_write_masked;
   gpio->get_pins = bcm2835_gpio_get_pins;
   gpio->get_bits = bcm2835_gpio_get_bits;
+  gpio->set_enable_event_detect_bits =
+      bcm2835_gpio_set_enable_event_detect_bits;
+  gpio->clear_enable_event_detect_bits =
+      bcm2835_gpio_clear_enable_event_detect_bits;
+  gpio->get_and_clear_events = bcm2835_gpio_get_and_clear_events;
 
   gpio->ext = ext;
 
+  for (int reg = 0; reg < 6; reg++) {
+    ext->gpfsel[reg] = *(ext->base + GPFSEL0 + reg);
+  }
+  ext->pull_known = 0;
+  ext->pull_up = 0;
+  ext->pull_down = 0;
+
   return GPIO_SUCCESS;
 }
@@ -46,7 +46,7 @@ static const int GPEDS0    = 0x40 >> 2;
 static const int GPEDS1    = 0x44 >> 2;
 static const int GPREN0    = 0x4C >> 2;
 static const int GPREN1    = 0x50 >> 2;
-static const int GPFEN0    = 0x48 >> 2;
+static const int GPFEN0    = 0x58 >> 2;
 static const int GPFEN1    = 0x5C >> 2;
 static const int GPHEN0    = 0x64 >> 2;
 static const int GPHEN1    = 0x68 >> 2;
@@ -61,26 +61,27 @@ static const int GPPUDCLK0 = 0x98 >> 2;
 static const int GPPUDCLK1 = 0x9C >> 2;
 // clang-format on
 
-typedef uint32_t detection_type_t;
-
-// clang-format off
-static const detection_type_t DETECT_RISING        = 1 << 0;
-static const detection_type_t DETECT_FALLING       = 1 << 1;
-static const detection_type_t DETECT_HI            = 1 << 2;
-static const detection_type_t DETECT_LO            = 1 << 3;
-static const detection_type_t DETECT_ASYNC_RISING  = 1 << 4;
-static const detection_type_t DETECT_ASYNC_FALLING = 1 << 5;
-// clang-format on
-
-static const detection_type_t DETECT_ALL =
-    DETECT_RISING | DETECT_FALLING | DETECT_HI | DETECT_LO |
-    DETECT_ASYNC_RISING | DETECT_ASYNC_FALLING;
-
 /**
- * Extension structure for BCM2835 GPIO
+ * Extension structure for BCM2835 GPIO.
+ *
+ * The driver keeps shadows of the configuration registers, so changing pin
+ * functions and pulls needs no register reads, and only the registers whose
+ * values change are written. The shadows are loaded by the init function;
+ * this assumes nothing else reconfigures the pins while they are in use.
  */
 typedef struct {
   volatile uint32_t *base;
+
+  uint32_t gpfsel[6];
+
+  // BCM2711 pull-up/down registers.
+  uint32_t pup_pdn_cntrl[4];
+
+  // The BCM2835 pulls cannot be read back, so track the pull last applied
+  // to each pin. Pins not in pull_known have not been set since init.
+  uint64_t pull_known;
+  uint64_t pull_up;
+  uint64_t pull_down;
 } bcm2835_gpio_ext_t;
 
 /**
@@ -125,7 +126,8 @@ int bcm2835_gpio_set_function_pins(gpio_t *gpio, pin_t *pins, size_t n,
 
 /**
  * Get the GPIO pin functions. The caller provides a pointer to an
- * array that holds the function values for the requested pins.
+ * array that holds the function values for the requested pins. The values
+ * come from the driver's shadow of the GPFSEL registers.
  *
  * @param[in] gpio The GPIO data structure
  * @param[in] pins The list of pins whose function to be changed.
@@ -157,6 +159,19 @@ int bcm2835_gpio_set_bits(gpio_t *gpio, uint64_t pins, char value);
  */
 int bcm2835_gpio_set_pins(gpio_t *gpio, pin_t *pins, size_t n, char value);
 
+/**
+ * Set and clear (up to the first 64) GPIO bits. Each mask is written with at
+ * most one GPSETn or GPCLRn store per register bank, and banks with no bits
+ * to change are skipped. A pin in both masks ends up cleared.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] set_pins The mask of GPIO bits to set.
+ * @param[in] clear_pins The mask of GPIO bits to clear.
+ * @return GPIO_SUCCESS on success.
+ */
+int bcm2835_gpio_write_masked(gpio_t *gpio, uint64_t set_pins,
+                              uint64_t clear_pins);
+
 /**
  * Get the values of the first 64 GPIO bits.
  *
@@ -181,7 +196,7 @@ int bcm2835_gpio_get_pins(gpio_t *gpio, pin_t *pins, char *values, size_t n);
  * Get the event flags, and clear them to prepare for the next events.
  *
  * @param[in] gpio The GPIO data structure.
- * @param[out] vaues The pins which have at least one triggered event.
+ * @param[out] values The pins which have at least one triggered event.
  * @return GPIO_SUCCESS on success.
  */
 int bcm2835_gpio_get_and_clear_events(gpio_t *gpio, uint64_t *values);
@@ -4,16 +4,25 @@ set -xeu
 SIMH_SRC=${SIMH_SRC:-../simh}
 SIMH_OBJ="sim_sock.o"
 
-COMMON_OBJ="pidp11.o gpio.o bcm2835_gpio.o bcm2711_gpio.o rp1_gpio.o"
+COMMON_OBJ="pidp11.o pidp11_console.o pidp11_glow.o pidp11_loader.o pidp11_memory.o pidp11_mmu.o pidp11_telemetry.o matrix.o gpio.o gpio_device.o gpio_emu.o gpio_stats.o bcm2835_gpio.o bcm2711_gpio.o rp1_gpio.o gpiochip_gpio.o"
 
 CC_FLAGS=${CC_FLAGS:-"-Wall"}
 DEBUG_FLAGS=${DEBUG_FLAGS:-"-DDEBUG -g"}
 
+# Set GPIO_BACKEND to bcm2835, bcm2711, rp1 or gpiochip to have the display
+# refresh loop call that backend directly, instead of through the gpio_t.
+GPIO_BACKEND=${GPIO_BACKEND:-}
+BACKEND_FLAGS=""
+if [ -n "$GPIO_BACKEND" ]; then
+  BACKEND_FLAGS="-DGPIO_BACKEND=$GPIO_BACKEND"
+fi
+
 for f in *.c ; do
-  gcc $CC_FLAGS $DEBUG_FLAGS -I$SIMH_SRC -c $f
+  gcc $CC_FLAGS $DEBUG_FLAGS $BACKEND_FLAGS -I$SIMH_SRC -c $f
 done
 
 gcc -Wno-unused-function $CC_FLAGS $DEBUG_FLAGS -I$SIMH_SRC -c $SIMH_SRC/sim_sock.c
 
 gcc -o pidp11 main.o $SIMH_OBJ $COMMON_OBJ
 gcc -o pidp11-off pidp11-off.o $COMMON_OBJ
+gcc -o pidp11-bench pidp11-bench.o $COMMON_OBJ
@@ -2,4 +2,4 @@
 set -xeu
 
 rm *.o \
-   pidp11 pidp11-off
+   pidp11 pidp11-off pidp11-bench
@@ -36,7 +36,7 @@ uint64_t pins_to_bits(pin_t *pins, size_t n) {
   uint64_t bits = 0;
   for (int i = 0; i < n; i++) {
     if (pins[i] < 64) {
-      bits |= 1 << pins[i];
+      bits |= (uint64_t)1 << pins[i];
     }
   }
   return bits;
@@ -53,10 +53,9 @@ uint64_t pins_to_bits(pin_t *pins, size_t n) {
 int bits_to_pins(uint64_t bits, pin_t *pins, size_t n) {
   int index = 0;
   for (int bit = 0; bit < n; bit++) {
-    if ((bits & (1 << bit)) != 0) {
+    if ((bits & ((uint64_t)1 << bit)) != 0) {
       pins[index++] = bit;
     }
-    bit++;
   }
   return index;
 }
@@ -119,6 +118,21 @@ int gpio_set_bits(gpio_t *gpio, uint64_t pins, char value) {
   }
 }
 
+int gpio_write_masked(gpio_t *gpio, uint64_t set_pins, uint64_t clear_pins) {
+  if (gpio->write_masked) {
+    return (gpio->write_masked)(gpio, set_pins, clear_pins);
+  } else {
+    int ret = GPIO_SUCCESS;
+    if (set_pins) {
+      ret = gpio_set_bits(gpio, set_pins, 1);
+    }
+    if (ret == GPIO_SUCCESS && clear_pins) {
+      ret = gpio_set_bits(gpio, clear_pins, 0);
+    }
+    return ret;
+  }
+}
+
 int gpio_get_pins(gpio_t *gpio, pin_t *pins, char *values, size_t n) {
   if (gpio->get_pins) {
     return (gpio->get_pins)(gpio, pins, values, n);
@@ -127,7 +141,7 @@ int gpio_get_pins(gpio_t *gpio, pin_t *pins, char *values, size_t n) {
     int ret = (gpio->get_bits)(gpio, &value);
     if (ret == 0) {
       for (int i = 0; i < n; i++) {
-        values[i] = (value & (1 << pins[1])) ? -1 : 0;
+        values[i] = (value & ((uint64_t)1 << pins[i])) ? -1 : 0;
       }
     }
     return ret;
@@ -148,10 +162,40 @@ int gpio_get_bits(gpio_t *gpio, uint64_t *value) {
     uint64_t v = 0;
     for (int i = 0; i < 64; i++) {
       if (values[i]) {
-        v |= (1 << i);
+        v |= ((uint64_t)1 << i);
       }
     }
     *value = v;
     return ret;
   }
 }
+
+int gpio_set_enable_event_detect_bits(gpio_t *gpio, uint64_t pins,
+                                      detection_type_t value) {
+  if (gpio->set_enable_event_detect_bits == NULL) {
+    return GPIO_ERR_UNSUPPORTED;
+  }
+  return (gpio->set_enable_event_detect_bits)(gpio, pins, value);
+}
+
+int gpio_clear_enable_event_detect_bits(gpio_t *gpio, uint64_t pins,
+                                        detection_type_t value) {
+  if (gpio->clear_enable_event_detect_bits == NULL) {
+    return GPIO_ERR_UNSUPPORTED;
+  }
+  return (gpio->clear_enable_event_detect_bits)(gpio, pins, value);
+}
+
+int gpio_get_and_clear_events(gpio_t *gpio, uint64_t *pins) {
+  if (gpio->get_and_clear_events == NULL) {
+    return GPIO_ERR_UNSUPPORTED;
+  }
+  return (gpio->get_and_clear_events)(gpio, pins);
+}
+
+int gpio_get_event_times(gpio_t *gpio, uint64_t pins, int64_t *times) {
+  if (gpio->get_event_times == NULL) {
+    return GPIO_ERR_UNSUPPORTED;
+  }
+  return (gpio->get_event_times)(gpio, pins, times);
+}
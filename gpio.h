@@ -43,6 +43,21 @@ typedef enum _pin_function_t {
 
 typedef enum _pull_control_t { OFF, DOWN, UP } pull_control_t;
 
+typedef uint32_t detection_type_t;
+
+// clang-format off
+static const detection_type_t DETECT_RISING        = 1 << 0;
+static const detection_type_t DETECT_FALLING       = 1 << 1;
+static const detection_type_t DETECT_HI            = 1 << 2;
+static const detection_type_t DETECT_LO            = 1 << 3;
+static const detection_type_t DETECT_ASYNC_RISING  = 1 << 4;
+static const detection_type_t DETECT_ASYNC_FALLING = 1 << 5;
+// clang-format on
+
+static const detection_type_t DETECT_ALL =
+    DETECT_RISING | DETECT_FALLING | DETECT_HI | DETECT_LO |
+    DETECT_ASYNC_RISING | DETECT_ASYNC_FALLING;
+
 typedef struct _gpio_t {
   int (*close)(struct _gpio_t *gpio);
 
@@ -58,16 +73,27 @@ typedef struct _gpio_t {
 
   int (*set_pins)(struct _gpio_t *gpio, pin_t *pins, size_t n, char value);
   int (*set_bits)(struct _gpio_t *gpio, uint64_t pins, char value);
+  int (*write_masked)(struct _gpio_t *gpio, uint64_t set_pins,
+                      uint64_t clear_pins);
 
   int (*get_pins)(struct _gpio_t *gpio, pin_t *pins, char *values, size_t n);
   int (*get_bits)(struct _gpio_t *gpio, uint64_t *value);
 
+  int (*set_enable_event_detect_bits)(struct _gpio_t *gpio, uint64_t pins,
+                                      detection_type_t value);
+  int (*clear_enable_event_detect_bits)(struct _gpio_t *gpio, uint64_t pins,
+                                        detection_type_t value);
+  int (*get_and_clear_events)(struct _gpio_t *gpio, uint64_t *pins);
+  int (*get_event_times)(struct _gpio_t *gpio, uint64_t pins,
+                         int64_t *times);
+
   void *ext;
 } gpio_t;
 
 static const int GPIO_SUCCESS = 0;
 static const int GPIO_ERR_INVALID_PIN = 1;
 static const int GPIO_ERR_INVALID_BASE = 2;
+static const int GPIO_ERR_UNSUPPORTED = 3;
 
 /**
  * Close a GPIO device.
@@ -142,6 +168,17 @@ int gpio_set_pins(gpio_t *gpio, pin_t *pins, size_t n, char value);
  */
 int gpio_set_bits(gpio_t *gpio, uint64_t pins, char value);
 
+/**
+ * Set some pins high and others low in a single operation. Backends that
+ * support it apply each mask with at most one store per register bank.
+ *
+ * @param gpio the GPIO device.
+ * @param set_pins the set of pins to set high.
+ * @param clear_pins the set of pins to set low.
+ * @return zero on success.
+ */
+int gpio_write_masked(gpio_t *gpio, uint64_t set_pins, uint64_t clear_pins);
+
 /**
  * Get the values of the list of pins.
  *
@@ -162,6 +199,56 @@ int gpio_get_pins(gpio_t *gpio, pin_t *pins, char *values, size_t n);
  */
 int gpio_get_bits(gpio_t *gpio, uint64_t *value);
 
+/**
+ * Enable event detection on the set of pins. Detected events are latched
+ * until gpio_get_and_clear_events() is called.
+ *
+ * @param gpio the GPIO device.
+ * @param pins the set of pins whose event detection will be enabled.
+ * @param value the DETECT_* types of event to enable.
+ * @return zero on success, GPIO_ERR_UNSUPPORTED if the device has no event
+ * detection.
+ */
+int gpio_set_enable_event_detect_bits(gpio_t *gpio, uint64_t pins,
+                                      detection_type_t value);
+
+/**
+ * Disable event detection on the set of pins.
+ *
+ * @param gpio the GPIO device.
+ * @param pins the set of pins whose event detection will be disabled.
+ * @param value the DETECT_* types of event to disable.
+ * @return zero on success, GPIO_ERR_UNSUPPORTED if the device has no event
+ * detection.
+ */
+int gpio_clear_enable_event_detect_bits(gpio_t *gpio, uint64_t pins,
+                                        detection_type_t value);
+
+/**
+ * Get the set of pins with at least one latched event, and clear those
+ * events.
+ *
+ * @param gpio the GPIO device.
+ * @param pins the destination of the set of pins with events.
+ * @return zero on success, GPIO_ERR_UNSUPPORTED if the device has no event
+ * detection.
+ */
+int gpio_get_and_clear_events(gpio_t *gpio, uint64_t *pins);
+
+/**
+ * Get the CLOCK_MONOTONIC times of the latest events that
+ * gpio_get_and_clear_events() took on the pins, as timestamped by the
+ * kernel.
+ *
+ * @param gpio the GPIO device.
+ * @param pins the set of pins to get the times of.
+ * @param times the destination of the times in nanoseconds, indexed by pin,
+ * zero for a pin with no event yet.
+ * @return zero on success, GPIO_ERR_UNSUPPORTED if the device does not
+ * timestamp events.
+ */
+int gpio_get_event_times(gpio_t *gpio, uint64_t pins, int64_t *times);
+
 /**
  * Iterate through the pins array, setting the bits in the resulting value.
  *
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bcm2711_gpio.h"
+#include "bcm2835_gpio.h"
+#include "gpio_device.h"
+#include "gpio_emu.h"
+#include "gpiochip_gpio.h"
+#include "rp1_gpio.h"
+
+static int map_gpiomem(gpio_device_t *device, const char *path,
+                       size_t length) {
+  int mem_fd = open(path, O_RDWR | O_SYNC);
+  if (mem_fd < 0) {
+    return -1;
+  }
+  void *base =
+      mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+  close(mem_fd);
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+
+  device->base = (volatile uint32_t *)base;
+  device->length = length;
+  return 0;
+}
+
+int gpio_device_open(gpio_device_t *device, const char *name) {
+  memset(device, 0, sizeof *device);
+  if (name == NULL || *name == '\0') {
+    name = "bcm2835";
+  }
+
+  if (strncmp(name, "gpiochip", strlen("gpiochip")) == 0) {
+    snprintf(device->gpiochip.path, sizeof device->gpiochip.path, "/dev/%s",
+             name);
+    return gpiochip_gpio_init(&device->gpio, &device->gpiochip);
+  } else if (strcmp(name, "bcm2835") == 0 || strcmp(name, "bcm2711") == 0) {
+    if (map_gpiomem(device, "/dev/gpiomem", 0x100)) {
+      return -1;
+    }
+  } else if (strcmp(name, "rp1") == 0) {
+    if (map_gpiomem(device, "/dev/gpiomem0", 0x30000)) {
+      return -1;
+    }
+  } else if (strcmp(name, "emu-bcm2835") == 0) {
+    if (gpio_emu_open(&device->emu, GPIO_EMU_BCM2835)) {
+      return -1;
+    }
+    device->emulated = 1;
+    device->base = device->emu.base;
+  } else if (strcmp(name, "emu-bcm2711") == 0) {
+    if (gpio_emu_open(&device->emu, GPIO_EMU_BCM2711)) {
+      return -1;
+    }
+    device->emulated = 1;
+    device->base = device->emu.base;
+  } else if (strcmp(name, "emu-rp1") == 0) {
+    if (gpio_emu_open(&device->emu, GPIO_EMU_RP1)) {
+      return -1;
+    }
+    device->emulated = 1;
+    device->base = device->emu.base;
+  } else {
+    return -1;
+  }
+
+  if (strstr(name, "rp1") != NULL) {
+    device->rp1.base = device->base;
+    return rp1_gpio_init(&device->gpio, &device->rp1);
+  }
+  device->bcm2835.base = device->base;
+  if (strstr(name, "bcm2711") != NULL) {
+    return bcm2711_gpio_init(&device->gpio, &device->bcm2835);
+  }
+  return bcm2835_gpio_init(&device->gpio, &device->bcm2835);
+}
+
+int gpio_device_enable_stats(gpio_device_t *device) {
+#ifdef GPIO_BACKEND
+  // The refresh loop calls the backend's functions directly, with whatever
+  // gpio_t it was given, and they would take the wrapper's ext for their own.
+  return -1;
+#else
+  if (device->stats_enabled) {
+    return 0;
+  }
+  device->backend = device->gpio;
+  if (gpio_stats_init(&device->gpio, &device->stats, &device->backend)) {
+    return -1;
+  }
+  device->stats_enabled = 1;
+  return gpio_stats_dump_on_signal(&device->stats, stderr);
+#endif
+}
+
+int gpio_device_close(gpio_device_t *device) {
+  gpio_close(&device->gpio);
+  if (device->stats_enabled) {
+    gpio_stats_dump(&device->stats, stderr);
+  }
+  if (device->emulated) {
+    gpio_emu_dump(&device->emu, stderr);
+    return gpio_emu_close(&device->emu);
+  }
+  if (device->base == NULL) {
+    return 0; // not mapped.
+  }
+  return munmap((void *)device->base, device->length);
+}
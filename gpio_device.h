@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef GPIO_DEVICE_H
+#define GPIO_DEVICE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bcm2835_gpio.h"
+#include "gpio.h"
+#include "gpio_emu.h"
+#include "gpio_stats.h"
+#include "gpiochip_gpio.h"
+#include "rp1_gpio.h"
+
+/**
+ * A GPIO device: the gpio_t, its driver data, and the register mapping
+ * behind it.
+ */
+typedef struct _gpio_device_t {
+  gpio_t gpio;
+  gpio_t backend;
+  gpio_stats_ext_t stats;
+  int stats_enabled;
+  bcm2835_gpio_ext_t bcm2835;
+  rp1_gpio_ext_t rp1;
+  gpiochip_gpio_ext_t gpiochip;
+  gpio_emu_t emu;
+  int emulated;
+  volatile uint32_t *base;
+  size_t length;
+} gpio_device_t;
+
+/**
+ * Open a GPIO device by name. The names are:
+ *
+ *   bcm2835      BCM2835 registers from /dev/gpiomem (the default)
+ *   bcm2711      BCM2711 registers from /dev/gpiomem
+ *   rp1          RP1 bank 0 registers from /dev/gpiomem0
+ *   gpiochipN    the Linux GPIO character device /dev/gpiochipN
+ *   emu-bcm2835  an emulated BCM2835 register file
+ *   emu-bcm2711  an emulated BCM2711 register file
+ *   emu-rp1      an emulated RP1 register file
+ *
+ * @param[out] device The device data structure. It must not move while the
+ *                    device is open.
+ * @param[in] name The device name, or NULL for the default.
+ * @return zero on success.
+ */
+int gpio_device_open(gpio_device_t *device, const char *name);
+
+/**
+ * Record statistics for the operations on an open GPIO device, and print them
+ * to stderr on SIGUSR1 and when the device is closed. Call this before
+ * handing device->gpio to anything that keeps it.
+ *
+ * In a build with GPIO_BACKEND set, this fails: the display refresh loop
+ * calls the backend directly, and cannot be handed a wrapped gpio_t.
+ *
+ * @param[in] device The device data structure.
+ * @return zero on success.
+ */
+int gpio_device_enable_stats(gpio_device_t *device);
+
+/**
+ * Close a GPIO device. An emulated device prints its register access counts
+ * to stderr, and a device with statistics enabled prints its statistics.
+ *
+ * @param[in] device The device data structure.
+ * @return zero on success.
+ */
+int gpio_device_close(gpio_device_t *device);
+#endif
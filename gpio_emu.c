@@ -0,0 +1,481 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "bcm2711_gpio.h"
+#include "bcm2835_gpio.h"
+#include "gpio_emu.h"
+#include "rp1_gpio.h"
+
+#if defined(__linux__) && defined(__x86_64__)
+#define GPIO_EMU_TRAPS 1
+#endif
+
+static const uint64_t BCM_PIN_MASK = 0x003fffffffffffff; // 54 pins.
+static const int BCM_N_PINS = 54;
+static const size_t BCM_WINDOW = 0x1000;
+
+static const uint64_t RP1_PIN_MASK = 0x000000000fffffff; // 28 pins.
+static const size_t RP1_WINDOW = 0x30000;
+static const int RP1_BLOCK = 0x4000 >> 2;   // each block and its aliases.
+static const int RP1_ALIAS = 0x1000 >> 2;   // the stride between aliases.
+static const uint32_t RP1_CTRL_RESET = 0x1f; // FUNCSEL NULL.
+static const uint32_t RP1_PAD_RESET = 0x56;  // IE, 4mA, PDE, SCHMITT.
+
+typedef struct {
+  const char *name;
+  int offset;
+} reg_name_t;
+
+static gpio_emu_t *active;
+
+/*
+ * BCM2835 / BCM2711 model.
+ */
+
+static uint64_t bcm_pair(gpio_emu_t *emu, int reg) {
+  return emu->regs[reg] | ((uint64_t)emu->regs[reg + 1] << 32);
+}
+
+static int bcm_pin_function(gpio_emu_t *emu, int pin) {
+  return (emu->regs[GPFSEL0 + pin / 10] >> ((pin % 10) * 3)) & 0x7;
+}
+
+static pull_control_t bcm_pin_pull(gpio_emu_t *emu, int pin) {
+  if (emu->model == GPIO_EMU_BCM2711) {
+    int v = (emu->regs[GPIO_PUP_PDN_CNTRL_REG0 + (pin >> 4)] >>
+             ((pin & 0xf) << 1)) &
+            0x3;
+    return v == 1 ? UP : v == 2 ? DOWN : OFF;
+  }
+  return emu->pulls[pin];
+}
+
+/*
+ * Recompute the pin levels, and latch any events the change in levels
+ * triggers. Unconnected inputs with no pull read low.
+ */
+static void bcm_update(gpio_emu_t *emu) {
+  uint64_t levels = 0;
+  for (int pin = 0; pin < BCM_N_PINS; pin++) {
+    uint64_t bit = (uint64_t)1 << pin;
+    int level;
+    if (bcm_pin_function(emu, pin) == OUT) {
+      level = (emu->outputs & bit) != 0;
+    } else if (emu->driven & bit) {
+      level = (emu->inputs & bit) != 0;
+    } else {
+      level = bcm_pin_pull(emu, pin) == UP;
+    }
+    if (level) {
+      levels |= bit;
+    }
+  }
+
+  uint64_t changed = levels ^ emu->levels;
+  uint64_t rising = bcm_pair(emu, GPREN0) | bcm_pair(emu, GPAREN0);
+  uint64_t falling = bcm_pair(emu, GPFEN0) | bcm_pair(emu, GPAFEN0);
+  emu->events |= ((changed & levels & rising) |
+                  (changed & ~levels & falling) |
+                  (levels & bcm_pair(emu, GPHEN0)) |
+                  (~levels & bcm_pair(emu, GPLEN0))) &
+                 BCM_PIN_MASK;
+  emu->levels = levels;
+}
+
+static uint32_t bcm_read(gpio_emu_t *emu, int offset) {
+  bcm_update(emu);
+  if (offset == GPSET0 || offset == GPSET1 || offset == GPCLR0 ||
+      offset == GPCLR1) {
+    return 0; // write-only
+  } else if (offset == GPLEV0) {
+    return emu->levels;
+  } else if (offset == GPLEV1) {
+    return emu->levels >> 32;
+  } else if (offset == GPEDS0) {
+    return emu->events;
+  } else if (offset == GPEDS1) {
+    return emu->events >> 32;
+  }
+  return emu->regs[offset];
+}
+
+static void bcm_write(gpio_emu_t *emu, int offset, uint32_t value) {
+  if (offset == GPSET0) {
+    emu->outputs |= value;
+  } else if (offset == GPSET1) {
+    emu->outputs |= ((uint64_t)value << 32) & BCM_PIN_MASK;
+  } else if (offset == GPCLR0) {
+    emu->outputs &= ~(uint64_t)value;
+  } else if (offset == GPCLR1) {
+    emu->outputs &= ~((uint64_t)value << 32);
+  } else if (offset == GPLEV0 || offset == GPLEV1) {
+    // read-only
+  } else if (offset == GPEDS0) {
+    emu->events &= ~(uint64_t)value; // write 1 to clear
+  } else if (offset == GPEDS1) {
+    emu->events &= ~((uint64_t)value << 32);
+  } else if (emu->model == GPIO_EMU_BCM2835 &&
+             (offset == GPPUDCLK0 || offset == GPPUDCLK1)) {
+    // Clocking a pin latches the control value in GPPUD.
+    int first = offset == GPPUDCLK0 ? 0 : 32;
+    for (int i = 0; i < 32 && first + i < BCM_N_PINS; i++) {
+      if (value & (1U << i)) {
+        emu->pulls[first + i] = emu->regs[GPPUD] & 0x3;
+      }
+    }
+    emu->regs[offset] = value;
+  } else {
+    emu->regs[offset] = value;
+  }
+  bcm_update(emu);
+}
+
+/*
+ * RP1 model. IO_BANK0, RIO and PADS_BANK0 each have a normal register block
+ * followed by XOR, SET and CLR alias blocks; the model keeps only the normal
+ * registers, and applies aliased stores to them.
+ */
+
+static void rp1_update(gpio_emu_t *emu) {
+  uint32_t out = emu->regs[RP1_RIO0 + RP1_RIO_OUT];
+  uint32_t oe = emu->regs[RP1_RIO0 + RP1_RIO_OE];
+  uint64_t levels = 0;
+
+  for (int pin = 0; pin < RP1_N_PINS; pin++) {
+    uint64_t bit = (uint64_t)1 << pin;
+    uint32_t ctrl = emu->regs[RP1_GPIO0_CTRL + (pin * 2)];
+    uint32_t pad = emu->regs[RP1_PADS_BANK0 + RP1_PADS_GPIO0 + pin];
+    int level;
+    if ((ctrl & RP1_CTRL_FUNCSEL) == RP1_FUNCSEL_SYS_RIO && (oe & bit)) {
+      level = (out & bit) != 0;
+    } else if (emu->driven & bit) {
+      level = (emu->inputs & bit) != 0;
+    } else {
+      level = (pad & RP1_PAD_PUE) != 0;
+    }
+    if (level && (pad & RP1_PAD_IE)) {
+      levels |= bit;
+    }
+  }
+  emu->levels = levels;
+}
+
+static uint32_t rp1_read(gpio_emu_t *emu, int offset) {
+  int reg = offset - (offset % RP1_BLOCK) + (offset % RP1_ALIAS);
+
+  rp1_update(emu);
+  if (reg == RP1_RIO0 + RP1_RIO_SYNC_IN ||
+      reg == RP1_RIO0 + RP1_RIO_NOSYNC_IN) {
+    return emu->levels;
+  }
+  return emu->regs[reg];
+}
+
+static void rp1_write(gpio_emu_t *emu, int offset, uint32_t value) {
+  int reg = offset - (offset % RP1_BLOCK) + (offset % RP1_ALIAS);
+  int alias = (offset % RP1_BLOCK) / RP1_ALIAS;
+
+  if (reg == RP1_RIO0 + RP1_RIO_SYNC_IN ||
+      reg == RP1_RIO0 + RP1_RIO_NOSYNC_IN) {
+    return; // read-only
+  }
+  if (alias == 1) {
+    emu->regs[reg] ^= value;
+  } else if (alias == 2) {
+    emu->regs[reg] |= value;
+  } else if (alias == 3) {
+    emu->regs[reg] &= ~value;
+  } else {
+    emu->regs[reg] = value;
+  }
+  if (reg == RP1_RIO0 + RP1_RIO_OUT || reg == RP1_RIO0 + RP1_RIO_OE) {
+    emu->regs[reg] &= RP1_PIN_MASK;
+  }
+  rp1_update(emu);
+}
+
+static void rp1_reset(gpio_emu_t *emu) {
+  for (int pin = 0; pin < RP1_N_PINS; pin++) {
+    emu->regs[RP1_GPIO0_CTRL + (pin * 2)] = RP1_CTRL_RESET;
+    emu->regs[RP1_PADS_BANK0 + RP1_PADS_GPIO0 + pin] = RP1_PAD_RESET;
+  }
+}
+
+static const char *rp1_reg_name(int offset, char *buf, size_t size) {
+  static const char *aliases[] = {"", ".xor", ".set", ".clr"};
+  static const char *rio_names[] = {"RIO_OUT", "RIO_OE", "RIO_NOSYNC_IN",
+                                    "RIO_SYNC_IN"};
+  int block = offset / RP1_BLOCK;
+  int alias = (offset % RP1_BLOCK) / RP1_ALIAS;
+  int reg = offset % RP1_ALIAS;
+
+  if (block == 0 && reg < RP1_N_PINS * 2) {
+    snprintf(buf, size, "GPIO%d_%s%s", reg / 2,
+             (reg & 1) ? "CTRL" : "STATUS", aliases[alias]);
+  } else if (block == RP1_RIO0 / RP1_BLOCK && reg <= RP1_RIO_SYNC_IN) {
+    snprintf(buf, size, "%s%s", rio_names[reg], aliases[alias]);
+  } else if (block == RP1_PADS_BANK0 / RP1_BLOCK && reg == 0) {
+    snprintf(buf, size, "PADS_VOLTAGE_SELECT%s", aliases[alias]);
+  } else if (block == RP1_PADS_BANK0 / RP1_BLOCK && reg <= RP1_N_PINS) {
+    snprintf(buf, size, "PADS_GPIO%d%s", reg - 1, aliases[alias]);
+  } else {
+    return NULL;
+  }
+  return buf;
+}
+
+static void model_update(gpio_emu_t *emu) {
+  if (emu->model == GPIO_EMU_RP1) {
+    rp1_update(emu);
+  } else {
+    bcm_update(emu);
+  }
+}
+
+// clang-format off
+static const reg_name_t bcm_reg_names[] = {
+  {"GPFSEL0", 0x00 >> 2}, {"GPFSEL1", 0x04 >> 2}, {"GPFSEL2", 0x08 >> 2},
+  {"GPFSEL3", 0x0C >> 2}, {"GPFSEL4", 0x10 >> 2}, {"GPFSEL5", 0x14 >> 2},
+  {"GPSET0", 0x1C >> 2},  {"GPSET1", 0x20 >> 2},  {"GPCLR0", 0x28 >> 2},
+  {"GPCLR1", 0x2C >> 2},  {"GPLEV0", 0x34 >> 2},  {"GPLEV1", 0x38 >> 2},
+  {"GPEDS0", 0x40 >> 2},  {"GPEDS1", 0x44 >> 2},  {"GPREN0", 0x4C >> 2},
+  {"GPREN1", 0x50 >> 2},  {"GPFEN0", 0x58 >> 2},  {"GPFEN1", 0x5C >> 2},
+  {"GPHEN0", 0x64 >> 2},  {"GPHEN1", 0x68 >> 2},  {"GPLEN0", 0x70 >> 2},
+  {"GPLEN1", 0x74 >> 2},  {"GPAREN0", 0x7C >> 2}, {"GPAREN1", 0x80 >> 2},
+  {"GPAFEN0", 0x88 >> 2}, {"GPAFEN1", 0x8C >> 2}, {"GPPUD", 0x94 >> 2},
+  {"GPPUDCLK0", 0x98 >> 2}, {"GPPUDCLK1", 0x9C >> 2},
+  {"GPIO_PUP_PDN_CNTRL_REG0", 0xE4 >> 2},
+  {"GPIO_PUP_PDN_CNTRL_REG1", 0xE8 >> 2},
+  {"GPIO_PUP_PDN_CNTRL_REG2", 0xEC >> 2},
+  {"GPIO_PUP_PDN_CNTRL_REG3", 0xF0 >> 2},
+  {NULL, 0}
+};
+// clang-format on
+
+/*
+ * Access trapping.
+ *
+ * The window is mapped PROT_NONE. A load or store to it raises SIGSEGV; the
+ * handler fills the register with the model's value, opens the window, and
+ * sets the trap flag so the access executes as a single step. The SIGTRAP
+ * that follows applies any stored value to the model and closes the window.
+ */
+
+#ifdef GPIO_EMU_TRAPS
+static const long long EFLAGS_TF = 0x100;
+static const long long PF_WRITE = 0x2;
+
+static atomic_flag busy = ATOMIC_FLAG_INIT;
+static int pending_offset = -1;
+static int pending_write;
+
+static uint32_t model_read(gpio_emu_t *emu, int offset) {
+  if (emu->model == GPIO_EMU_RP1) {
+    return rp1_read(emu, offset);
+  }
+  return bcm_read(emu, offset);
+}
+
+static void model_write(gpio_emu_t *emu, int offset, uint32_t value) {
+  if (emu->model == GPIO_EMU_RP1) {
+    rp1_write(emu, offset, value);
+  } else {
+    bcm_write(emu, offset, value);
+  }
+}
+
+static void segv_handler(int signum, siginfo_t *info, void *context) {
+  ucontext_t *uc = (ucontext_t *)context;
+  gpio_emu_t *emu = active;
+  uintptr_t addr = (uintptr_t)info->si_addr;
+  uintptr_t base = (uintptr_t)(emu ? emu->base : NULL);
+
+  if (emu == NULL || addr < base || addr >= base + emu->length) {
+    // Not an emulated register: fault again with the default action.
+    signal(SIGSEGV, SIG_DFL);
+    return;
+  }
+
+  while (atomic_flag_test_and_set(&busy)) {
+  }
+
+  int offset = (addr - base) >> 2;
+  mprotect((void *)emu->base, emu->length, PROT_READ | PROT_WRITE);
+  ((uint32_t *)emu->base)[offset] = model_read(emu, offset);
+  pending_offset = offset;
+  pending_write = (uc->uc_mcontext.gregs[REG_ERR] & PF_WRITE) != 0;
+  uc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+}
+
+static void trap_handler(int signum, siginfo_t *info, void *context) {
+  ucontext_t *uc = (ucontext_t *)context;
+  gpio_emu_t *emu = active;
+
+  if (emu == NULL || pending_offset < 0) {
+    signal(SIGTRAP, SIG_DFL);
+    raise(SIGTRAP);
+    return;
+  }
+
+  int offset = pending_offset;
+  if (pending_write) {
+    emu->writes[offset]++;
+    model_write(emu, offset, ((uint32_t *)emu->base)[offset]);
+  } else {
+    emu->reads[offset]++;
+  }
+  pending_offset = -1;
+  mprotect((void *)emu->base, emu->length, PROT_NONE);
+  uc->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+
+  atomic_flag_clear(&busy);
+}
+#endif
+
+int gpio_emu_open(gpio_emu_t *emu, gpio_emu_model_t model) {
+#ifdef GPIO_EMU_TRAPS
+  if (active != NULL) {
+    return -1; // only one emulator at a time.
+  }
+
+  memset(emu, 0, sizeof *emu);
+  emu->model = model;
+  emu->length = (model == GPIO_EMU_RP1) ? RP1_WINDOW : BCM_WINDOW;
+
+  size_t n = emu->length >> 2;
+  emu->reads = calloc(n, sizeof(uint64_t));
+  emu->writes = calloc(n, sizeof(uint64_t));
+  emu->regs = calloc(n, sizeof(uint32_t));
+  void *base = mmap(NULL, emu->length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0);
+  if (emu->reads == NULL || emu->writes == NULL || emu->regs == NULL ||
+      base == MAP_FAILED) {
+    free(emu->reads);
+    free(emu->writes);
+    free(emu->regs);
+    return -1;
+  }
+  emu->base = (volatile uint32_t *)base;
+
+  struct sigaction segv_action = {.sa_sigaction = segv_handler,
+                                  .sa_flags = SA_SIGINFO};
+  struct sigaction trap_action = {.sa_sigaction = trap_handler,
+                                  .sa_flags = SA_SIGINFO};
+  sigaction(SIGSEGV, &segv_action, NULL);
+  sigaction(SIGTRAP, &trap_action, NULL);
+
+  active = emu;
+  if (model == GPIO_EMU_RP1) {
+    rp1_reset(emu);
+  }
+  model_update(emu);
+  return 0;
+#else
+  return -1; // trapping register accesses is not supported on this host.
+#endif
+}
+
+int gpio_emu_close(gpio_emu_t *emu) {
+  if (active != emu) {
+    return -1;
+  }
+  active = NULL;
+  signal(SIGSEGV, SIG_DFL);
+  signal(SIGTRAP, SIG_DFL);
+
+  munmap((void *)emu->base, emu->length);
+  free(emu->reads);
+  free(emu->writes);
+  free(emu->regs);
+  emu->base = NULL;
+  return 0;
+}
+
+void gpio_emu_drive_bits(gpio_emu_t *emu, uint64_t pins, char value) {
+  emu->driven |= pins;
+  if (value) {
+    emu->inputs |= pins;
+  } else {
+    emu->inputs &= ~pins;
+  }
+  model_update(emu);
+}
+
+void gpio_emu_release_bits(gpio_emu_t *emu, uint64_t pins) {
+  emu->driven &= ~pins;
+  model_update(emu);
+}
+
+void gpio_emu_get_counts(gpio_emu_t *emu, uint64_t *reads, uint64_t *writes) {
+  uint64_t r = 0;
+  uint64_t w = 0;
+  for (size_t i = 0; i < emu->length >> 2; i++) {
+    r += emu->reads[i];
+    w += emu->writes[i];
+  }
+  *reads = r;
+  *writes = w;
+}
+
+void gpio_emu_reset_counts(gpio_emu_t *emu) {
+  memset(emu->reads, 0, (emu->length >> 2) * sizeof(uint64_t));
+  memset(emu->writes, 0, (emu->length >> 2) * sizeof(uint64_t));
+}
+
+void gpio_emu_dump(gpio_emu_t *emu, FILE *out) {
+  for (size_t i = 0; i < emu->length >> 2; i++) {
+    if (emu->reads[i] == 0 && emu->writes[i] == 0) {
+      continue;
+    }
+    char buf[32];
+    const char *name = NULL;
+    if (emu->model == GPIO_EMU_RP1) {
+      name = rp1_reg_name(i, buf, sizeof buf);
+    } else {
+      for (const reg_name_t *r = bcm_reg_names; r->name; r++) {
+        if (r->offset == i) {
+          name = r->name;
+        }
+      }
+    }
+    if (name) {
+      fprintf(out, "%-24s", name);
+    } else {
+      fprintf(out, "+0x%05zx%15s", i << 2, "");
+    }
+    fprintf(out, " reads: %8llu  writes: %8llu\n",
+            (unsigned long long)emu->reads[i],
+            (unsigned long long)emu->writes[i]);
+  }
+}
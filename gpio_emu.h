@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef GPIO_EMU_H
+#define GPIO_EMU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * An emulated GPIO register file, for running the GPIO drivers on a host
+ * without GPIO hardware.
+ *
+ * The emulator hands out a register window that is mapped with no access.
+ * Every load or store the driver makes to it traps, is counted, and is
+ * applied to a model of the SoC's GPIO block, so the drivers run unmodified
+ * and the number of register accesses they make is exact.
+ *
+ * Only one emulator may be open at a time. Trapping requires x86-64 Linux;
+ * elsewhere gpio_emu_open() fails. The emulator is for single-threaded
+ * programs: while one thread's access is single-stepped, the window is open
+ * to every thread, so an access another thread makes then is neither counted
+ * nor applied to the model, and the register state goes wrong.
+ */
+
+typedef enum _gpio_emu_model_t {
+  GPIO_EMU_BCM2835,
+  GPIO_EMU_BCM2711,
+  GPIO_EMU_RP1
+} gpio_emu_model_t;
+
+typedef struct _gpio_emu_t {
+  gpio_emu_model_t model;
+
+  // The register window to pass to the driver.
+  volatile uint32_t *base;
+  size_t length;
+
+  // Access counts, indexed by register offset.
+  uint64_t *reads;
+  uint64_t *writes;
+
+  // Model state.
+  uint32_t *regs;
+  uint64_t outputs;
+  uint64_t driven;
+  uint64_t inputs;
+  uint64_t levels;
+  uint64_t events;
+  uint8_t pulls[64];
+} gpio_emu_t;
+
+/**
+ * Open an emulated GPIO register file.
+ *
+ * @param[in] emu The emulator data structure.
+ * @param[in] model The SoC whose GPIO block is emulated.
+ * @return zero on success.
+ */
+int gpio_emu_open(gpio_emu_t *emu, gpio_emu_model_t model);
+
+/**
+ * Close an emulated GPIO register file, and release its window.
+ *
+ * @param[in] emu The emulator data structure.
+ * @return zero on success.
+ */
+int gpio_emu_close(gpio_emu_t *emu);
+
+/**
+ * Drive pins from outside the SoC, as a switch or jumper would. Pins that are
+ * inputs read these values instead of their pull resistors.
+ *
+ * @param[in] emu The emulator data structure.
+ * @param[in] pins The set of pins to drive.
+ * @param[in] value if zero, drive the pins low, otherwise drive them high.
+ */
+void gpio_emu_drive_bits(gpio_emu_t *emu, uint64_t pins, char value);
+
+/**
+ * Stop driving pins from outside the SoC.
+ *
+ * @param[in] emu The emulator data structure.
+ * @param[in] pins The set of pins to release.
+ */
+void gpio_emu_release_bits(gpio_emu_t *emu, uint64_t pins);
+
+/**
+ * Get the total register access counts since open or the last reset.
+ *
+ * @param[in] emu The emulator data structure.
+ * @param[out] reads The number of register loads.
+ * @param[out] writes The number of register stores.
+ */
+void gpio_emu_get_counts(gpio_emu_t *emu, uint64_t *reads, uint64_t *writes);
+
+/**
+ * Reset the register access counts to zero.
+ *
+ * @param[in] emu The emulator data structure.
+ */
+void gpio_emu_reset_counts(gpio_emu_t *emu);
+
+/**
+ * Print the access counts of each register that has been accessed.
+ *
+ * @param[in] emu The emulator data structure.
+ * @param[in] out The stream to print to.
+ */
+void gpio_emu_dump(gpio_emu_t *emu, FILE *out);
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef GPIO_FAST_H
+#define GPIO_FAST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "gpio.h"
+
+/*
+ * The GPIO operations used by the display refresh loop.
+ *
+ * By default these dispatch through the gpio_t, the same as the gpio_*
+ * functions, so one binary can drive any backend. When GPIO_BACKEND names a
+ * backend at compile time (-DGPIO_BACKEND=bcm2835, bcm2711, rp1 or gpiochip),
+ * they call that backend's functions directly instead. The gpio_t must still
+ * be initialized by the matching backend, since the backend functions use its
+ * ext data; gpio_fast_device_name() checks the device name for that.
+ */
+#ifdef GPIO_BACKEND
+
+#include "bcm2711_gpio.h"
+#include "bcm2835_gpio.h"
+#include "gpiochip_gpio.h"
+#include "rp1_gpio.h"
+
+#define GPIO_FAST_CONCAT(backend, op) backend##_gpio_##op
+#define GPIO_FAST_FN(backend, op) GPIO_FAST_CONCAT(backend, op)
+#define GPIO_FAST_STR(backend) #backend
+#define GPIO_FAST_NAME(backend) GPIO_FAST_STR(backend)
+
+#define GPIO_FAST_MODE "static " GPIO_FAST_NAME(GPIO_BACKEND)
+
+static inline int gpio_fast_set_function_pins(gpio_t *gpio, pin_t *pins,
+                                              size_t n, pin_function_t value) {
+  return GPIO_FAST_FN(GPIO_BACKEND, set_function_pins)(gpio, pins, n, value);
+}
+
+static inline int gpio_fast_set_pull_pins(gpio_t *gpio, pin_t *pins, size_t n,
+                                          pull_control_t value) {
+  return GPIO_FAST_FN(GPIO_BACKEND, set_pull_pins)(gpio, pins, n, value);
+}
+
+static inline int gpio_fast_set_pins(gpio_t *gpio, pin_t *pins, size_t n,
+                                     char value) {
+  return GPIO_FAST_FN(GPIO_BACKEND, set_pins)(gpio, pins, n, value);
+}
+
+static inline int gpio_fast_set_bits(gpio_t *gpio, uint64_t pins, char value) {
+  return GPIO_FAST_FN(GPIO_BACKEND, set_bits)(gpio, pins, value);
+}
+
+static inline int gpio_fast_write_masked(gpio_t *gpio, uint64_t set_pins,
+                                         uint64_t clear_pins) {
+  return GPIO_FAST_FN(GPIO_BACKEND, write_masked)(gpio, set_pins, clear_pins);
+}
+
+static inline int gpio_fast_get_bits(gpio_t *gpio, uint64_t *value) {
+  return GPIO_FAST_FN(GPIO_BACKEND, get_bits)(gpio, value);
+}
+
+/**
+ * Check a gpio_device name against the backend the refresh loop calls.
+ *
+ * @param name the device name, or NULL for the default.
+ * @return the name, or the backend's own when it is NULL or empty; NULL if
+ *         the device is not driven by the backend.
+ */
+static inline const char *gpio_fast_device_name(const char *name) {
+  const char *backend = GPIO_FAST_NAME(GPIO_BACKEND);
+  int numbered = strcmp(backend, "gpiochip") == 0;
+  if (name == NULL || *name == '\0') {
+    return numbered ? "gpiochip0" : backend;
+  }
+  // An emulated register file runs the same backend, and gpiochip devices
+  // are numbered.
+  const char *device = strncmp(name, "emu-", 4) == 0 ? name + 4 : name;
+  if (numbered
+          ? strncmp(device, backend, strlen(backend)) != 0
+          : strcmp(device, backend) != 0) {
+    return NULL;
+  }
+  return name;
+}
+
+#else
+
+#define GPIO_FAST_MODE "gpio_t"
+
+static inline int gpio_fast_set_function_pins(gpio_t *gpio, pin_t *pins,
+                                              size_t n, pin_function_t value) {
+  return gpio_set_function_pins(gpio, pins, n, value);
+}
+
+static inline int gpio_fast_set_pull_pins(gpio_t *gpio, pin_t *pins, size_t n,
+                                          pull_control_t value) {
+  return gpio_set_pull_pins(gpio, pins, n, value);
+}
+
+static inline int gpio_fast_set_pins(gpio_t *gpio, pin_t *pins, size_t n,
+                                     char value) {
+  return gpio_set_pins(gpio, pins, n, value);
+}
+
+static inline int gpio_fast_set_bits(gpio_t *gpio, uint64_t pins, char value) {
+  return gpio_set_bits(gpio, pins, value);
+}
+
+static inline int gpio_fast_write_masked(gpio_t *gpio, uint64_t set_pins,
+                                         uint64_t clear_pins) {
+  return gpio_write_masked(gpio, set_pins, clear_pins);
+}
+
+static inline int gpio_fast_get_bits(gpio_t *gpio, uint64_t *value) {
+  return gpio_get_bits(gpio, value);
+}
+
+static inline const char *gpio_fast_device_name(const char *name) {
+  return name;
+}
+
+#endif
+#endif
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <time.h>
+
+#include "gpio_stats.h"
+
+static const char *op_names[GPIO_STATS_N_OPS] = {
+    "set_function_pins",
+    "set_function_bits",
+    "set_pull_pins",
+    "set_pull_bits",
+    "set_pins",
+    "set_bits",
+    "write_masked",
+    "get_pins",
+    "get_bits",
+    "set_enable_event_detect",
+    "clear_enable_event_detect",
+    "get_and_clear_events"};
+
+static gpio_stats_ext_t *signal_ext;
+static FILE *signal_out;
+static sem_t signal_sem;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Record one call of an operation, which started at start_ns.
+ */
+static void record(gpio_stats_ext_t *ext, gpio_stats_op_t op, uint64_t pins,
+                   int fallback, uint64_t start_ns) {
+  gpio_stats_op_stats_t *stats = &ext->ops[op];
+  uint64_t ns = now_ns() - start_ns;
+  int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+
+  stats->calls++;
+  stats->pins += pins;
+  stats->fallbacks += fallback != 0;
+  stats->total_ns += ns;
+  stats->histogram[bucket < 32 ? bucket : 31]++;
+}
+
+static int stats_close(gpio_t *gpio) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  return gpio_close(ext->inner);
+}
+
+static int stats_set_function_pins(gpio_t *gpio, pin_t *pins, size_t n,
+                                   pin_function_t value) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_set_function_pins(ext->inner, pins, n, value);
+  record(ext, GPIO_STATS_SET_FUNCTION_PINS, n,
+         ext->inner->set_function_pins == NULL, start);
+  return ret;
+}
+
+static int stats_set_function_bits(gpio_t *gpio, uint64_t pins,
+                                   pin_function_t value) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_set_function_bits(ext->inner, pins, value);
+  record(ext, GPIO_STATS_SET_FUNCTION_BITS, __builtin_popcountll(pins),
+         ext->inner->set_function_bits == NULL, start);
+  return ret;
+}
+
+static int stats_set_pull_pins(gpio_t *gpio, pin_t *pins, size_t n,
+                               pull_control_t value) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_set_pull_pins(ext->inner, pins, n, value);
+  record(ext, GPIO_STATS_SET_PULL_PINS, n, ext->inner->set_pull_pins == NULL,
+         start);
+  return ret;
+}
+
+static int stats_set_pull_bits(gpio_t *gpio, uint64_t pins,
+                               pull_control_t value) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_set_pull_bits(ext->inner, pins, value);
+  record(ext, GPIO_STATS_SET_PULL_BITS, __builtin_popcountll(pins),
+         ext->inner->set_pull_bits == NULL, start);
+  return ret;
+}
+
+static int stats_set_pins(gpio_t *gpio, pin_t *pins, size_t n, char value) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_set_pins(ext->inner, pins, n, value);
+  record(ext, GPIO_STATS_SET_PINS, n, ext->inner->set_pins == NULL, start);
+  return ret;
+}
+
+static int stats_set_bits(gpio_t *gpio, uint64_t pins, char value) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_set_bits(ext->inner, pins, value);
+  record(ext, GPIO_STATS_SET_BITS, __builtin_popcountll(pins),
+         ext->inner->set_bits == NULL, start);
+  return ret;
+}
+
+static int stats_write_masked(gpio_t *gpio, uint64_t set_pins,
+                              uint64_t clear_pins) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_write_masked(ext->inner, set_pins, clear_pins);
+  record(ext, GPIO_STATS_WRITE_MASKED,
+         __builtin_popcountll(set_pins | clear_pins),
+         ext->inner->write_masked == NULL, start);
+  return ret;
+}
+
+static int stats_get_pins(gpio_t *gpio, pin_t *pins, char *values, size_t n) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_get_pins(ext->inner, pins, values, n);
+  record(ext, GPIO_STATS_GET_PINS, n, ext->inner->get_pins == NULL, start);
+  return ret;
+}
+
+static int stats_get_bits(gpio_t *gpio, uint64_t *value) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_get_bits(ext->inner, value);
+  record(ext, GPIO_STATS_GET_BITS, 64, ext->inner->get_bits == NULL, start);
+  return ret;
+}
+
+static int stats_set_enable_event_detect_bits(gpio_t *gpio, uint64_t pins,
+                                              detection_type_t value) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_set_enable_event_detect_bits(ext->inner, pins, value);
+  record(ext, GPIO_STATS_SET_EVENT_DETECT, __builtin_popcountll(pins), 0,
+         start);
+  return ret;
+}
+
+static int stats_clear_enable_event_detect_bits(gpio_t *gpio, uint64_t pins,
+                                                detection_type_t value) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_clear_enable_event_detect_bits(ext->inner, pins, value);
+  record(ext, GPIO_STATS_CLEAR_EVENT_DETECT, __builtin_popcountll(pins), 0,
+         start);
+  return ret;
+}
+
+static int stats_get_and_clear_events(gpio_t *gpio, uint64_t *pins) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  uint64_t start = now_ns();
+  int ret = gpio_get_and_clear_events(ext->inner, pins);
+  record(ext, GPIO_STATS_GET_AND_CLEAR_EVENTS, 64, 0, start);
+  return ret;
+}
+
+// Only reads what get_and_clear_events recorded, so it is not counted.
+static int stats_get_event_times(gpio_t *gpio, uint64_t pins, int64_t *times) {
+  gpio_stats_ext_t *ext = (gpio_stats_ext_t *)gpio->ext;
+  return gpio_get_event_times(ext->inner, pins, times);
+}
+
+int gpio_stats_init(gpio_t *gpio, gpio_stats_ext_t *ext, gpio_t *inner) {
+  if (gpio == NULL || ext == NULL || inner == NULL) {
+    return -1;
+  }
+
+  ext->inner = inner;
+  for (int op = 0; op < GPIO_STATS_N_OPS; op++) {
+    ext->ops[op] = (gpio_stats_op_stats_t){0};
+  }
+
+  gpio->close = stats_close;
+  gpio->set_function_pins = stats_set_function_pins;
+  gpio->set_function_bits = stats_set_function_bits;
+  gpio->set_pull_pins = stats_set_pull_pins;
+  gpio->set_pull_bits = stats_set_pull_bits;
+  gpio->set_pins = stats_set_pins;
+  gpio->set_bits = stats_set_bits;
+  gpio->write_masked = stats_write_masked;
+  gpio->get_pins = stats_get_pins;
+  gpio->get_bits = stats_get_bits;
+  gpio->set_enable_event_detect_bits = stats_set_enable_event_detect_bits;
+  gpio->clear_enable_event_detect_bits = stats_clear_enable_event_detect_bits;
+  gpio->get_and_clear_events = stats_get_and_clear_events;
+  gpio->get_event_times = stats_get_event_times;
+
+  gpio->ext = ext;
+
+  return GPIO_SUCCESS;
+}
+
+void gpio_stats_dump(gpio_stats_ext_t *ext, FILE *out) {
+  fprintf(out, "%-26s %10s %10s %10s %10s\n", "operation", "calls", "pins",
+          "fallbacks", "mean ns");
+  for (int op = 0; op < GPIO_STATS_N_OPS; op++) {
+    gpio_stats_op_stats_t *stats = &ext->ops[op];
+    if (stats->calls == 0) {
+      continue;
+    }
+    fprintf(out, "%-26s %10llu %10llu %10llu %10llu\n", op_names[op],
+            (unsigned long long)stats->calls, (unsigned long long)stats->pins,
+            (unsigned long long)stats->fallbacks,
+            (unsigned long long)(stats->total_ns / stats->calls));
+    fprintf(out, "  ns:");
+    for (int i = 0; i < 32; i++) {
+      if (stats->histogram[i] != 0) {
+        fprintf(out, " %llu+:%llu", 1ULL << i,
+                (unsigned long long)stats->histogram[i]);
+      }
+    }
+    fprintf(out, "\n");
+  }
+  fflush(out);
+}
+
+static void signal_handler(int signum) { sem_post(&signal_sem); }
+
+static void *signal_thread(void *context) {
+  while (1) {
+    if (sem_wait(&signal_sem) == 0) {
+      gpio_stats_dump(signal_ext, signal_out);
+    }
+  }
+  return NULL;
+}
+
+int gpio_stats_dump_on_signal(gpio_stats_ext_t *ext, FILE *out) {
+  pthread_t thread;
+
+  if (signal_ext != NULL) {
+    return -1; // only one at a time.
+  }
+  signal_ext = ext;
+  signal_out = out;
+  if (sem_init(&signal_sem, 0, 0) ||
+      pthread_create(&thread, NULL, signal_thread, NULL)) {
+    signal_ext = NULL;
+    return -1;
+  }
+  pthread_detach(thread);
+
+  struct sigaction action = {.sa_handler = signal_handler,
+                             .sa_flags = SA_RESTART};
+  sigemptyset(&action.sa_mask);
+  return sigaction(SIGUSR1, &action, NULL);
+}
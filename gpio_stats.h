@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef GPIO_STATS_H
+#define GPIO_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gpio.h"
+
+/*
+ * A GPIO driver that forwards every operation to another GPIO driver, and
+ * records, for each operation, the number of calls, the number of pins they
+ * name, how many of them use a fallback in gpio.c because the driver has no
+ * native implementation, and a histogram of their latencies.
+ *
+ * With GPIO_BACKEND set at compile time, the display refresh loop calls the
+ * backend's functions directly, which take the gpio_t's ext for their own, so
+ * a gpio_t this driver wraps cannot be used there, and gpio_device refuses to
+ * enable the statistics.
+ */
+
+typedef enum _gpio_stats_op_t {
+  GPIO_STATS_SET_FUNCTION_PINS,
+  GPIO_STATS_SET_FUNCTION_BITS,
+  GPIO_STATS_SET_PULL_PINS,
+  GPIO_STATS_SET_PULL_BITS,
+  GPIO_STATS_SET_PINS,
+  GPIO_STATS_SET_BITS,
+  GPIO_STATS_WRITE_MASKED,
+  GPIO_STATS_GET_PINS,
+  GPIO_STATS_GET_BITS,
+  GPIO_STATS_SET_EVENT_DETECT,
+  GPIO_STATS_CLEAR_EVENT_DETECT,
+  GPIO_STATS_GET_AND_CLEAR_EVENTS,
+  GPIO_STATS_N_OPS
+} gpio_stats_op_t;
+
+/**
+ * The statistics of one operation. Bucket i of the histogram counts the
+ * calls that took from 2^i up to 2^(i+1) nanoseconds; bucket 0 also counts
+ * calls that took under a nanosecond.
+ */
+typedef struct {
+  uint64_t calls;
+  uint64_t pins;
+  uint64_t fallbacks;
+  uint64_t total_ns;
+  uint64_t histogram[32];
+} gpio_stats_op_stats_t;
+
+/**
+ * Extension structure for the statistics driver.
+ */
+typedef struct {
+  gpio_t *inner;
+  gpio_stats_op_stats_t ops[GPIO_STATS_N_OPS];
+} gpio_stats_ext_t;
+
+/**
+ * Initialize a statistics driver that forwards to another GPIO driver.
+ *
+ * @param[in] gpio The GPIO data structure to initialize.
+ * @param[in] ext The extension structure.
+ * @param[in] inner The initialized GPIO driver to forward to.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpio_stats_init(gpio_t *gpio, gpio_stats_ext_t *ext, gpio_t *inner);
+
+/**
+ * Print the statistics of each operation that has been called.
+ *
+ * @param[in] ext The extension structure.
+ * @param[in] out The stream to print to.
+ */
+void gpio_stats_dump(gpio_stats_ext_t *ext, FILE *out);
+
+/**
+ * Print the statistics to a stream each time the process receives SIGUSR1.
+ * The statistics are printed by a separate thread, not the signal handler.
+ * Only one statistics driver can be watched.
+ *
+ * @param[in] ext The extension structure.
+ * @param[in] out The stream to print to.
+ * @return zero on success.
+ */
+int gpio_stats_dump_on_signal(gpio_stats_ext_t *ext, FILE *out);
+#endif
@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "gpiochip_gpio.h"
+
+static const char *CONSUMER = "altpi-11";
+
+static uint64_t bit(pin_t pin) { return (uint64_t)1 << pin; }
+
+/**
+ * The set of pins in any group.
+ */
+static uint64_t requested_pins(gpiochip_gpio_ext_t *ext) {
+  uint64_t pins = 0;
+  for (int g = 0; g < ext->n_groups; g++) {
+    pins |= ext->groups[g].mask;
+  }
+  return pins;
+}
+
+/**
+ * Convert a set of pins into the bits of a group's line request.
+ */
+static uint64_t to_lines(gpiochip_gpio_group_t *group, uint64_t pins) {
+  uint64_t lines = 0;
+  for (int i = 0; i < group->n; i++) {
+    if (pins & bit(group->pins[i])) {
+      lines |= (uint64_t)1 << i;
+    }
+  }
+  return lines;
+}
+
+/**
+ * Convert the bits of a group's line request into a set of pins.
+ */
+static uint64_t to_pins(gpiochip_gpio_group_t *group, uint64_t lines) {
+  uint64_t pins = 0;
+  for (int i = 0; i < group->n; i++) {
+    if (lines & ((uint64_t)1 << i)) {
+      pins |= bit(group->pins[i]);
+    }
+  }
+  return pins;
+}
+
+/**
+ * The line flags for a pin's configuration.
+ */
+static uint64_t line_flags(gpiochip_gpio_ext_t *ext, pin_t pin) {
+  uint64_t flags;
+
+  if (ext->outputs & bit(pin)) {
+    flags = GPIO_V2_LINE_FLAG_OUTPUT;
+  } else {
+    flags = GPIO_V2_LINE_FLAG_INPUT;
+    if (ext->rising & bit(pin)) {
+      flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+    }
+    if (ext->falling & bit(pin)) {
+      flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    }
+  }
+  if (ext->pull_up & bit(pin)) {
+    flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+  } else if (ext->pull_down & bit(pin)) {
+    flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+  } else if (ext->pull_known & bit(pin)) {
+    flags |= GPIO_V2_LINE_FLAG_BIAS_DISABLED;
+  }
+  return flags;
+}
+
+/**
+ * Build the configuration of a group: the flags of the first line are the
+ * default, and each other distinct set of flags is an attribute. The output
+ * values are the last attribute.
+ */
+static int build_config(gpiochip_gpio_ext_t *ext, gpiochip_gpio_group_t *group,
+                        struct gpio_v2_line_config *config) {
+  memset(config, 0, sizeof *config);
+  config->flags = line_flags(ext, group->pins[0]);
+
+  for (int i = 1; i < group->n; i++) {
+    uint64_t flags = line_flags(ext, group->pins[i]);
+    if (flags == config->flags) {
+      continue;
+    }
+    int a = 0;
+    while (a < config->num_attrs && config->attrs[a].attr.flags != flags) {
+      a++;
+    }
+    if (a == config->num_attrs) {
+      if (a == GPIO_V2_LINE_NUM_ATTRS_MAX - 1) {
+        return GPIO_ERR_UNSUPPORTED; // too many distinct configurations.
+      }
+      config->attrs[a].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+      config->attrs[a].attr.flags = flags;
+      config->num_attrs++;
+    }
+    config->attrs[a].mask |= (uint64_t)1 << i;
+  }
+
+  uint64_t outputs = to_lines(group, ext->outputs);
+  if (outputs != 0) {
+    struct gpio_v2_line_config_attribute *values =
+        &config->attrs[config->num_attrs++];
+    values->attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    values->attr.values = to_lines(group, ext->values);
+    values->mask = outputs;
+  }
+  return GPIO_SUCCESS;
+}
+
+/**
+ * Request a new group of lines from the chip.
+ */
+static int request_group(gpiochip_gpio_ext_t *ext, uint64_t pins) {
+  if (ext->n_groups == GPIOCHIP_GPIO_MAX_GROUPS) {
+    return GPIO_ERR_UNSUPPORTED;
+  }
+  gpiochip_gpio_group_t *group = &ext->groups[ext->n_groups];
+  struct gpio_v2_line_request request;
+
+  memset(group, 0, sizeof *group);
+  memset(&request, 0, sizeof request);
+  group->n = bits_to_pins(pins, group->pins, 64);
+  group->mask = pins;
+  for (int i = 0; i < group->n; i++) {
+    request.offsets[i] = group->pins[i];
+  }
+  request.num_lines = group->n;
+  strncpy(request.consumer, CONSUMER, sizeof request.consumer - 1);
+  if (build_config(ext, group, &request.config)) {
+    return GPIO_ERR_UNSUPPORTED;
+  }
+
+  ext->syscalls++;
+  if (ioctl(ext->chip_fd, GPIO_V2_GET_LINE_IOCTL, &request) < 0) {
+    return GPIO_ERR_INVALID_PIN;
+  }
+  group->fd = request.fd;
+  fcntl(group->fd, F_SETFL, fcntl(group->fd, F_GETFL) | O_NONBLOCK);
+
+  struct epoll_event event = {.events = EPOLLIN, .data.u32 = ext->n_groups};
+  epoll_ctl(ext->epoll_fd, EPOLL_CTL_ADD, group->fd, &event);
+  ext->n_groups++;
+
+  return GPIO_SUCCESS;
+}
+
+/**
+ * Apply the configuration of the pins: reconfigure the groups they are in,
+ * and request the ones that are in no group.
+ */
+static int configure(gpiochip_gpio_ext_t *ext, uint64_t pins) {
+  uint64_t requested = requested_pins(ext);
+
+  for (int g = 0; g < ext->n_groups; g++) {
+    gpiochip_gpio_group_t *group = &ext->groups[g];
+    if ((group->mask & pins) == 0) {
+      continue;
+    }
+    struct gpio_v2_line_config config;
+    if (build_config(ext, group, &config)) {
+      return GPIO_ERR_UNSUPPORTED;
+    }
+    ext->syscalls++;
+    if (ioctl(group->fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0) {
+      return GPIO_ERR_INVALID_PIN;
+    }
+  }
+  if ((pins & ~requested) != 0) {
+    return request_group(ext, pins & ~requested);
+  }
+  return GPIO_SUCCESS;
+}
+
+/**
+ * Drive the output lines among the pins to their values.
+ */
+static int drive(gpiochip_gpio_ext_t *ext, uint64_t pins) {
+  pins &= ext->outputs;
+  for (int g = 0; g < ext->n_groups && pins != 0; g++) {
+    gpiochip_gpio_group_t *group = &ext->groups[g];
+    if ((group->mask & pins) == 0) {
+      continue;
+    }
+    struct gpio_v2_line_values values = {
+        .bits = to_lines(group, ext->values),
+        .mask = to_lines(group, pins),
+    };
+    ext->syscalls++;
+    if (ioctl(group->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) {
+      return GPIO_ERR_INVALID_PIN;
+    }
+    pins &= ~group->mask;
+  }
+  return GPIO_SUCCESS;
+}
+
+int gpiochip_gpio_close(gpio_t *gpio) {
+  gpiochip_gpio_ext_t *ext = (gpiochip_gpio_ext_t *)gpio->ext;
+
+  for (int g = 0; g < ext->n_groups; g++) {
+    close(ext->groups[g].fd);
+  }
+  ext->n_groups = 0;
+  close(ext->epoll_fd);
+  close(ext->chip_fd);
+  return GPIO_SUCCESS;
+}
+
+int gpiochip_gpio_set_function_bits(gpio_t *gpio, uint64_t pins,
+                                    pin_function_t value) {
+  gpiochip_gpio_ext_t *ext = (gpiochip_gpio_ext_t *)gpio->ext;
+  uint64_t outputs = ext->outputs;
+  if (value == OUT) {
+    outputs |= pins;
+  } else if (value == IN) {
+    outputs &= ~pins;
+  } else {
+    return GPIO_ERR_UNSUPPORTED;
+  }
+  if (outputs == ext->outputs && (pins & ~requested_pins(ext)) == 0) {
+    return GPIO_SUCCESS;
+  }
+  ext->outputs = outputs;
+  return configure(ext, pins);
+}
+
+int gpiochip_gpio_set_function_pins(gpio_t *gpio, pin_t *pins, size_t n,
+                                    pin_function_t value) {
+  for (int i = 0; i < n; i++) {
+    if (pins[i] >= 64) {
+      return GPIO_ERR_INVALID_PIN;
+    }
+  }
+  return gpiochip_gpio_set_function_bits(gpio, pins_to_bits(pins, n), value);
+}
+
+int gpiochip_gpio_set_pull_bits(gpio_t *gpio, uint64_t pins,
+                                pull_control_t value) {
+  gpiochip_gpio_ext_t *ext = (gpiochip_gpio_ext_t *)gpio->ext;
+  uint64_t pull_up = ext->pull_up & ~pins;
+  uint64_t pull_down = ext->pull_down & ~pins;
+
+  if (value == UP) {
+    pull_up |= pins;
+  } else if (value == DOWN) {
+    pull_down |= pins;
+  }
+  if ((ext->pull_known & pins) == pins && pull_up == ext->pull_up &&
+      pull_down == ext->pull_down) {
+    return GPIO_SUCCESS;
+  }
+  ext->pull_known |= pins;
+  ext->pull_up = pull_up;
+  ext->pull_down = pull_down;
+
+  // Lines that have not been requested get their bias when they are.
+  return configure(ext, pins & requested_pins(ext));
+}
+
+int gpiochip_gpio_set_pull_pins(gpio_t *gpio, pin_t *pins, size_t n,
+                                pull_control_t value) {
+  for (int i = 0; i < n; i++) {
+    if (pins[i] >= 64) {
+      return GPIO_ERR_INVALID_PIN;
+    }
+  }
+  return gpiochip_gpio_set_pull_bits(gpio, pins_to_bits(pins, n), value);
+}
+
+int gpiochip_gpio_set_bits(gpio_t *gpio, uint64_t pins, char value) {
+  gpiochip_gpio_ext_t *ext = (gpiochip_gpio_ext_t *)gpio->ext;
+
+  if (value == 0) {
+    ext->values &= ~pins;
+  } else {
+    ext->values |= pins;
+  }
+  return drive(ext, pins);
+}
+
+int gpiochip_gpio_set_pins(gpio_t *gpio, pin_t *pins, size_t n, char value) {
+  for (int i = 0; i < n; i++) {
+    if (pins[i] >= 64) {
+      return GPIO_ERR_INVALID_PIN;
+    }
+  }
+  return gpiochip_gpio_set_bits(gpio, pins_to_bits(pins, n), value);
+}
+
+int gpiochip_gpio_write_masked(gpio_t *gpio, uint64_t set_pins,
+                               uint64_t clear_pins) {
+  gpiochip_gpio_ext_t *ext = (gpiochip_gpio_ext_t *)gpio->ext;
+
+  ext->values = (ext->values | set_pins) & ~clear_pins;
+  return drive(ext, set_pins | clear_pins);
+}
+
+int gpiochip_gpio_get_bits(gpio_t *gpio, uint64_t *values) {
+  gpiochip_gpio_ext_t *ext = (gpiochip_gpio_ext_t *)gpio->ext;
+  uint64_t result = ext->values & ext->outputs;
+
+  for (int g = 0; g < ext->n_groups; g++) {
+    gpiochip_gpio_group_t *group = &ext->groups[g];
+    uint64_t inputs = group->mask & ~ext->outputs;
+    if (inputs == 0) {
+      continue;
+    }
+    struct gpio_v2_line_values lines = {.mask = to_lines(group, inputs)};
+    ext->syscalls++;
+    if (ioctl(group->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &lines) < 0) {
+      return GPIO_ERR_INVALID_PIN;
+    }
+    result |= to_pins(group, lines.bits & lines.mask);
+  }
+  *values = result;
+  return GPIO_SUCCESS;
+}
+
+int gpiochip_gpio_get_pins(gpio_t *gpio, pin_t *pins, char *values, size_t n) {
+  uint64_t bits;
+  int ret = gpiochip_gpio_get_bits(gpio, &bits);
+
+  for (int i = 0; i < n; i++) {
+    if (pins[i] >= 64) {
+      return GPIO_ERR_INVALID_PIN;
+    }
+    values[i] = (bits & bit(pins[i])) ? -1 : 0; // all ones.
+  }
+  return ret;
+}
+
+int gpiochip_gpio_set_enable_event_detect_bits(gpio_t *gpio, uint64_t pins,
+                                               detection_type_t value) {
+  gpiochip_gpio_ext_t *ext = (gpiochip_gpio_ext_t *)gpio->ext;
+
+  if (value & (DETECT_HI | DETECT_LO)) {
+    return GPIO_ERR_UNSUPPORTED;
+  }
+  if (value & (DETECT_RISING | DETECT_ASYNC_RISING)) {
+    ext->rising |= pins;
+  }
+  if (value & (DETECT_FALLING | DETECT_ASYNC_FALLING)) {
+    ext->falling |= pins;
+  }
+  return configure(ext, pins & requested_pins(ext) & ~ext->outputs);
+}
+
+int gpiochip_gpio_clear_enable_event_detect_bits(gpio_t *gpio, uint64_t pins,
+                                                 detection_type_t value) {
+  gpiochip_gpio_ext_t *ext = (gpiochip_gpio_ext_t *)gpio->ext;
+
+  if (value & (DETECT_RISING | DETECT_ASYNC_RISING)) {
+    ext->rising &= ~pins;
+  }
+  if (value & (DETECT_FALLING | DETECT_ASYNC_FALLING)) {
+    ext->falling &= ~pins;
+  }
+  return configure(ext, pins & requested_pins(ext) & ~ext->outputs);
+}
+
+int gpiochip_gpio_get_and_clear_events(gpio_t *gpio, uint64_t *values) {
+  gpiochip_gpio_ext_t *ext = (gpiochip_gpio_ext_t *)gpio->ext;
+  uint64_t result = 0;
+  struct epoll_event ready[GPIOCHIP_GPIO_MAX_GROUPS];
+
+  // One poll finds the groups with pending events, so a frame without edges
+  // reads nothing.
+  ext->syscalls++;
+  int n_ready = epoll_wait(ext->epoll_fd, ready, GPIOCHIP_GPIO_MAX_GROUPS, 0);
+  for (int r = 0; r < n_ready; r++) {
+    gpiochip_gpio_group_t *group = &ext->groups[ready[r].data.u32];
+    struct gpio_v2_line_event events[16];
+    ssize_t n;
+    do {
+      ext->syscalls++;
+      n = read(group->fd, events, sizeof events);
+      for (int i = 0; i < n / (ssize_t)sizeof events[0]; i++) {
+        pin_t pin = events[i].offset;
+        if (pin < 64) {
+          result |= bit(pin);
+          ext->event_ns[pin] = events[i].timestamp_ns;
+        }
+      }
+    } while (n == sizeof events);
+  }
+  *values = result;
+  return GPIO_SUCCESS;
+}
+
+int gpiochip_gpio_get_event_times(gpio_t *gpio, uint64_t pins,
+                                  int64_t *times) {
+  gpiochip_gpio_ext_t *ext = (gpiochip_gpio_ext_t *)gpio->ext;
+
+  for (uint64_t bits = pins; bits != 0; bits &= bits - 1) {
+    int pin = __builtin_ctzll(bits);
+    times[pin] = (int64_t)ext->event_ns[pin];
+  }
+  return GPIO_SUCCESS;
+}
+
+int gpiochip_gpio_init(gpio_t *gpio, gpiochip_gpio_ext_t *ext) {
+  if (gpio == NULL || ext == NULL || ext->path[0] == '\0') {
+    return -1;
+  }
+
+  ext->chip_fd = open(ext->path, O_RDWR | O_CLOEXEC);
+  if (ext->chip_fd < 0) {
+    return -1;
+  }
+  ext->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (ext->epoll_fd < 0) {
+    close(ext->chip_fd);
+    return -1;
+  }
+  ext->n_groups = 0;
+
+  gpio->close = gpiochip_gpio_close;
+  gpio->set_function_pins = gpiochip_gpio_set_function_pins;
+  gpio->set_function_bits = gpiochip_gpio_set_function_bits;
+  gpio->set_pull_pins = gpiochip_gpio_set_pull_pins;
+  gpio->set_pull_bits = gpiochip_gpio_set_pull_bits;
+  gpio->set_pins = gpiochip_gpio_set_pins;
+  gpio->set_bits = gpiochip_gpio_set_bits;
+  gpio->write_masked = gpiochip_gpio_write_masked;
+  gpio->get_pins = gpiochip_gpio_get_pins;
+  gpio->get_bits = gpiochip_gpio_get_bits;
+  gpio->set_enable_event_detect_bits =
+      gpiochip_gpio_set_enable_event_detect_bits;
+  gpio->clear_enable_event_detect_bits =
+      gpiochip_gpio_clear_enable_event_detect_bits;
+  gpio->get_and_clear_events = gpiochip_gpio_get_and_clear_events;
+  gpio->get_event_times = gpiochip_gpio_get_event_times;
+
+  gpio->ext = ext;
+
+  return GPIO_SUCCESS;
+}
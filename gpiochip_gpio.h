@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef GPIOCHIP_GPIO_H
+#define GPIOCHIP_GPIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gpio.h"
+
+/*
+ * A GPIO driver for the Linux GPIO character device, /dev/gpiochipN, using
+ * the v2 uAPI. It needs no access to /dev/gpiomem, and works with any SoC
+ * with a kernel GPIO driver, or with the gpio-sim module.
+ *
+ * Pins are the chip's line offsets. Lines are requested from the kernel the
+ * first time their function is set, and all the lines in one
+ * set_function_bits() call share one line request. Setting or reading the
+ * lines of a request is a single GPIO_V2_LINE_SET_VALUES_IOCTL or
+ * GPIO_V2_LINE_GET_VALUES_IOCTL, so callers should set the functions of the
+ * pins they drive or read together in one call.
+ *
+ * The character device cannot select alternate functions, or detect levels.
+ */
+
+#define GPIOCHIP_GPIO_MAX_GROUPS 8
+
+/**
+ * A line request: a group of lines configured and accessed together.
+ */
+typedef struct {
+  int fd;
+  int n;
+  pin_t pins[64];
+  uint64_t mask;
+} gpiochip_gpio_group_t;
+
+/**
+ * Extension structure for the GPIO character device. Set path before calling
+ * gpiochip_gpio_init().
+ *
+ * The epoll_fd is readable when an edge event is pending on any line;
+ * gpiochip_gpio_get_and_clear_events() polls it once, reads the events of the
+ * ready groups, and records the kernel's CLOCK_MONOTONIC timestamp of the
+ * latest event on each pin in event_ns for gpiochip_gpio_get_event_times().
+ */
+typedef struct {
+  char path[64];
+  int chip_fd;
+  int epoll_fd;
+
+  int n_groups;
+  gpiochip_gpio_group_t groups[GPIOCHIP_GPIO_MAX_GROUPS];
+
+  // Line configuration and output values, by pin.
+  uint64_t outputs;
+  uint64_t values;
+  uint64_t pull_known;
+  uint64_t pull_up;
+  uint64_t pull_down;
+  uint64_t rising;
+  uint64_t falling;
+
+  uint64_t event_ns[64];
+
+  // The number of ioctl, epoll_wait and read system calls made.
+  uint64_t syscalls;
+} gpiochip_gpio_ext_t;
+
+/**
+ * Initialize the GPIO character device data structure, and open the chip.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] ext The extension structure, with the path of the chip.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_init(gpio_t *gpio, gpiochip_gpio_ext_t *ext);
+
+/**
+ * Release the lines, and close the chip.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_close(gpio_t *gpio);
+
+/**
+ * Set the GPIO pin functions. Only IN and OUT are supported. Pins that have
+ * not been requested are requested together, as one group.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The mask of pins whose function to change.
+ * @param[in] value The function to assign to the pins.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_set_function_bits(gpio_t *gpio, uint64_t pins,
+                                    pin_function_t value);
+
+/**
+ * Set the GPIO pin functions. Only IN and OUT are supported.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The list of pins whose function to be changed.
+ * @param[in] n The number of elements in the pins list.
+ * @param[in] value The function to assign to the pins.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_set_function_pins(gpio_t *gpio, pin_t *pins, size_t n,
+                                    pin_function_t value);
+
+/**
+ * Set the bias of the GPIO pins.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The mask of pins whose pullup/down configuration will change.
+ * @param[in] value The pullup/pulldown value to apply to the pins.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_set_pull_bits(gpio_t *gpio, uint64_t pins,
+                                pull_control_t value);
+
+/**
+ * Set the bias of the GPIO pins.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The list of pins whose pullup/down configuration will change.
+ * @param[in] n The number of elements in the pins list.
+ * @param[in] value The pullup/pulldown value to apply to the pins.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_set_pull_pins(gpio_t *gpio, pin_t *pins, size_t n,
+                                pull_control_t value);
+
+/**
+ * Set or clear GPIO bits, with one ioctl per group. The values of pins that
+ * are inputs are kept, and driven when they become outputs.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The mask of GPIO bits to set or clear.
+ * @param[in] value if zero, clear the bits, otherwise set the bits.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_set_bits(gpio_t *gpio, uint64_t pins, char value);
+
+/**
+ * Set or clear GPIO bits.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The list of GPIO pins to set or clear.
+ * @param[in] n The number of elements in the pins list.
+ * @param[in] value if zero, clear the bits, otherwise set the bits.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_set_pins(gpio_t *gpio, pin_t *pins, size_t n, char value);
+
+/**
+ * Set and clear GPIO bits, with one ioctl per group.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] set_pins The mask of GPIO bits to set.
+ * @param[in] clear_pins The mask of GPIO bits to clear.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_write_masked(gpio_t *gpio, uint64_t set_pins,
+                               uint64_t clear_pins);
+
+/**
+ * Get the values of the GPIO bits, with one ioctl per group that has input
+ * lines. Output lines read their last set values; lines that have not been
+ * requested read zero.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[out] values The values of the GPIO pins.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_get_bits(gpio_t *gpio, uint64_t *values);
+
+/**
+ * Get the values of the GPIO bits.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The list of GPIO pins to get.
+ * @param[out] values The values of the GPIO pins.
+ * @param[in] n The number of elements in the pins and values lists.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_get_pins(gpio_t *gpio, pin_t *pins, char *values, size_t n);
+
+/**
+ * Enable edge detection on the GPIO pins. Edges are only detected while a
+ * pin is an input. DETECT_ASYNC_RISING and DETECT_ASYNC_FALLING are treated
+ * as DETECT_RISING and DETECT_FALLING; level detection is not supported.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The mask of GPIO bits whose event detection will be enabled.
+ * @param[in] value The event detection type to enable.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_set_enable_event_detect_bits(gpio_t *gpio, uint64_t pins,
+                                               detection_type_t value);
+
+/**
+ * Disable edge detection on the GPIO pins.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The mask of GPIO bits whose event detection will be
+ * disabled.
+ * @param[in] value The event detection type to disable.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_clear_enable_event_detect_bits(gpio_t *gpio, uint64_t pins,
+                                                 detection_type_t value);
+
+/**
+ * Read the pending edge events without blocking, and record their
+ * timestamps.
+ *
+ * @param[in] gpio The GPIO data structure.
+ * @param[out] values The pins which have at least one event.
+ * @return GPIO_SUCCESS on success.
+ */
+int gpiochip_gpio_get_and_clear_events(gpio_t *gpio, uint64_t *values);
+int gpiochip_gpio_get_event_times(gpio_t *gpio, uint64_t pins, int64_t *times);
+#endif
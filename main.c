@@ -21,15 +21,25 @@
  */
 
 #include <errno.h>
-#include <fcntl.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
 
-#include "bcm2835_gpio.h"
+#include "gpio_device.h"
+#include "gpio_fast.h"
 #include "pidp11.h"
+#include "pidp11_console.h"
+#include "pidp11_glow.h"
+#include "pidp11_loader.h"
+#include "pidp11_memory.h"
+#include "pidp11_mmu.h"
+#include "pidp11_telemetry.h"
 
 // sim_frontpanel.c: suppress compiler warnings.
 #pragma GCC diagnostic push
@@ -41,66 +51,566 @@
 static uint16_t reg_pc = 0;
 static uint16_t reg_dr = 0;
 static uint16_t reg_r0 = 0;
+static uint16_t reg_psw = 0;
+static uint16_t reg_fps = 0;
+
+// The general registers behind the console's register addresses, but PC.
+static uint16_t reg_gr[PIDP11_MEMORY_REGISTERS];
+
+// The memory management registers, and the translations made from them,
+// under the lamp lock.
+static pidp11_mmu_t mmu;
+
+// The console address: loaded by LOAD ADRS, stepped by EXAM and DEP, and
+// where START starts, under the lamp lock. The address lamps show it in CONS
+// PHY, and after each of those switches.
+static uint32_t console_address = 0;
+
+// The sampled bit counts of PC, R0 and DR, and the lamp glow they drive, or
+// NULL if the simulator does not sample them.
+static int pc_bits[16];
+static int r0_bits[16];
+static int dr_bits[16];
+static pidp11_glow_t *glow = NULL;
 
 static int interrupt = 0;
 
+// Signalled by the panel thread when the simulator state changes.
+static int state_fd = -1;
+static OperationalState callback_state = Run;
+
 enum step_t { None, Exam, Dep };
 
 void sigint_handler(int signum) { interrupt = 1; }
 
-void update_display(pidp11_t *pidp11) {
+/**
+ * Get bit counts that hold a value steady, for a lamp with no sampled bits.
+ */
+static const int *steady_bits(uint32_t value, int n_bits, int *bits) {
+  for (int i = 0; i < n_bits; i++) {
+    bits[i] = (value >> i & 1) ? glow->sample_depth : 0;
+  }
+  return bits;
+}
+
+/**
+ * Show the register the DATA selector picks on the data lamps, with the lamp
+ * lock held.
+ *
+ * @return the register's sampled bit counts, or NULL if it has none.
+ */
+static const int *show_data(pidp11_t *pidp11) {
   switch (pidp11->data_mode) {
   case DATA_PATHS:
     pidp11->data = reg_r0;
+    return r0_bits;
+  case DATA_BUS_REG:
+    pidp11->data = reg_psw;
+    break;
+  case DATA_MU_A_FPP_CPU:
+    pidp11->data = reg_fps;
     break;
   case DATA_DISP_REG:
     pidp11->data = reg_dr;
-    break;
-  default:
-    pidp11->data = reg_r0; // TODO: support the other modes.
+    return dr_bits;
   }
+  return NULL;
+}
+
+/**
+ * Show the registers the ADDRESS and DATA selectors pick on the lamps. They
+ * are all sampled with each display callback, so turning a selector does
+ * not ask the simulator for anything. While the simulator runs, the address
+ * and data lamps glow with the sampled register bits, if there are any.
+ *
+ *   PROG PHY                         PC, relocated in the current mode
+ *   the virtual modes                PC
+ *   CONS PHY                         the console address
+ *   DATA PATHS                       R0
+ *   BUS REG                          PSW
+ *   µADR FPP/CPU                     FPS
+ *   DISPLAY REGISTER                 DR
+ */
+void update_display(pidp11_t *pidp11, int running) {
+  const int *address_bits = pc_bits;
+  const int *data_bits;
+  int steady_address[22];
+  int steady_data[16];
+  pidp11_mmu_mode_t mode = pidp11_mmu_psw_mode(reg_psw);
+  uint32_t physical;
+
+  pidp11_lock_lamps(pidp11);
+  pidp11_mmu_refresh(&mmu);
+  pidp11->addressing_length = mmu.length;
+  pidp11->run_level = mode == MMU_KERNEL  ? RUN_LEVEL_KERNEL
+                      : mode == MMU_SUPER ? RUN_LEVEL_SUPER
+                                          : RUN_LEVEL_USER;
+  data_bits = show_data(pidp11);
 
   switch (pidp11->addr_mode) {
+  case ADDR_CONS_PHY:
+    pidp11->address = console_address;
+    address_bits = NULL;
+    break;
   case ADDR_PROG_PHY:
     pidp11->address = reg_pc;
+    if (pidp11_mmu_translate(&mmu, mode, MMU_I, reg_pc, 0, &physical) == 0 &&
+        physical != reg_pc) {
+      pidp11->address = physical;
+      address_bits = NULL;
+    }
+    break;
   default:
-    pidp11->address = reg_pc; // TODO: support the other modes.
+    pidp11->address = reg_pc;
+  }
+
+  pidp11->glowing = running && glow != NULL;
+  if (pidp11->glowing) {
+    int n_address = 16;
+    if (address_bits == NULL) {
+      address_bits = steady_bits(pidp11->address, 22, steady_address);
+      n_address = 22;
+      if (pidp11->addr_mode == ADDR_PROG_PHY) {
+        // Relocation keeps the offset in the 64-byte block, so those bits
+        // still glow with the PC.
+        memcpy(steady_address, pc_bits, 6 * sizeof(int));
+      }
+    }
+    if (data_bits == NULL) {
+      data_bits = steady_bits(pidp11->data, 16, steady_data);
+    }
+    pidp11_glow_update(glow, address_bits, n_address, data_bits, 16,
+                       pidp11->glow);
   }
+  pidp11_unlock_lamps(pidp11);
+}
+
+/**
+ * Show the register the DATA selector picks on the data lamps, and leave the
+ * address lamps showing the console address.
+ */
+void update_data(pidp11_t *pidp11) {
+  pidp11_lock_lamps(pidp11);
+  show_data(pidp11);
+  pidp11_unlock_lamps(pidp11);
 }
 
 void display_callback(PANEL *panel, unsigned long long simulation_time,
                       void *context) {
   pidp11_t *pidp11 = (pidp11_t *)context;
   if (panel->State == Run) {
-    update_display(pidp11);
+    update_display(pidp11, 1);
+  }
+  if (panel->State != callback_state) {
+    callback_state = panel->State;
+    uint64_t one = 1;
+    if (write(state_fd, &one, sizeof one) != sizeof one) {
+      // The counter is saturated, so the main loop is already due to wake.
+    }
   }
 }
 
+/**
+ * Wait for switch events or a simulator state change, and clear the event
+ * fds that woke us. While the simulator runs, also wake every second, in
+ * case the panel does not report it halting.
+ *
+ * @return whether the simulator state changed.
+ */
+int wait_for_events(int epoll_fd, int running) {
+  struct epoll_event events[2];
+  int state_changed = 0;
+  int n = epoll_wait(epoll_fd, events, 2, running ? 1000 : -1);
+  for (int i = 0; i < n; i++) {
+    uint64_t count;
+    if (read(events[i].data.fd, &count, sizeof count) != sizeof count) {
+      // Already cleared.
+    }
+    state_changed |= events[i].data.fd == state_fd;
+  }
+  return state_changed;
+}
+
+int watch_fd(int epoll_fd, int fd) {
+  struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
 /**
  * Check for a rising edge by comparing the current value with
  * the previous value. If the previous value was zero and the current
- * value is non-zero, an edge was detected.
+ * value is non-zero, an edge was detected. A switch that changed
+ * without ending up where it was also had an edge: pressed and released
+ * if it is off now, or released and pressed again if it is on.
  * Set the previous value to the current value for the next time
  * this is called.
  */
-int rising_edge(int current_value, int *previous_value) {
+int rising_edge(uint64_t switches, uint64_t changed, uint64_t bit,
+                int *previous_value) {
+  int current_value = (switches & bit) != 0;
   int edge_detected = 0;
-  if (current_value && !*previous_value) {
+  if (current_value ? !*previous_value || (changed & bit)
+                    : !*previous_value && (changed & bit)) {
     edge_detected = 1;
   }
   *previous_value = current_value;
   return edge_detected;
 }
 
+/**
+ * Get the map a virtual ADDRESS selector position picks.
+ *
+ * @return zero for a virtual position, or -1 for a physical one.
+ */
+static int virtual_map(addr_mode_t addr_mode, pidp11_mmu_mode_t *mode,
+                       pidp11_mmu_space_t *space) {
+  switch (addr_mode) {
+  case ADDR_USER_D:
+    *mode = MMU_USER;
+    *space = MMU_D;
+    return 0;
+  case ADDR_SUPER_D:
+    *mode = MMU_SUPER;
+    *space = MMU_D;
+    return 0;
+  case ADDR_KERNEL_D:
+    *mode = MMU_KERNEL;
+    *space = MMU_D;
+    return 0;
+  case ADDR_KERNEL_I:
+    *mode = MMU_KERNEL;
+    *space = MMU_I;
+    return 0;
+  case ADDR_SUPER_I:
+    *mode = MMU_SUPER;
+    *space = MMU_I;
+    return 0;
+  case ADDR_USER_I:
+    *mode = MMU_USER;
+    *space = MMU_I;
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+/**
+ * Get the address EXAM and DEP reach from a console address. In the
+ * virtual ADDRESS selector positions, the console address is a 16-bit
+ * virtual address in that mode and space, and is relocated, unless it is
+ * a general register. ADRS ERR lights if the access would abort, as a
+ * deposit does in a read-only page.
+ *
+ * @param write whether the access is a deposit.
+ * @return zero on success, or -1 if the access would abort.
+ */
+int console_physical(pidp11_t *pidp11, uint32_t address, int write,
+                     uint32_t *physical) {
+  pidp11_mmu_mode_t mode;
+  pidp11_mmu_space_t space;
+  int result = 0;
+
+  pidp11_lock_lamps(pidp11);
+  *physical = address;
+  if (pidp11_memory_register(address) < 0 &&
+      virtual_map(pidp11->addr_mode, &mode, &space) == 0) {
+    result =
+        pidp11_mmu_translate(&mmu, mode, space, address, write, physical);
+  }
+  pidp11->address_err = result != 0;
+  pidp11_unlock_lamps(pidp11);
+  return result;
+}
+
+/**
+ * Advance the console address to the next word, or the next general
+ * register, if step is set, show it on the address lamps, and return it,
+ * without holding the lamp lock across calls into the panel.
+ */
+uint32_t step_address(pidp11_t *pidp11, int step) {
+  pidp11_lock_lamps(pidp11);
+  if (step) {
+    console_address += pidp11_memory_register(console_address) >= 0 ? 1 : 2;
+  }
+  uint32_t address = console_address;
+  pidp11->address = address;
+  pidp11_unlock_lamps(pidp11);
+  return address;
+}
+
+/**
+ * Load the console address, and show it on the address lamps.
+ */
+void load_address(pidp11_t *pidp11, uint32_t address) {
+  pidp11_lock_lamps(pidp11);
+  console_address = address;
+  pidp11->address = address;
+  pidp11_unlock_lamps(pidp11);
+}
+
+void set_data(pidp11_t *pidp11, uint16_t data) {
+  pidp11_lock_lamps(pidp11);
+  pidp11->data = data;
+  pidp11_unlock_lamps(pidp11);
+}
+
+/**
+ * Relay the simulator console to the controlling terminal, or to a pty, as
+ * PIDP11_CONSOLE says, so the simulator does not wait for a telnet client;
+ * and the lines of its terminal multiplexers to ptys linked in
+ * PIDP11_MUX_DIR. Returns zero if the bridge is running.
+ */
+int start_console(pidp11_console_t *console, const char *ini_path) {
+  const char *mode = getenv("PIDP11_CONSOLE");
+  const char *port_setting = getenv("PIDP11_CONSOLE_PORT");
+  const char *mux_dir = getenv("PIDP11_MUX_DIR");
+  int port = port_setting != NULL ? atoi(port_setting)
+                                  : pidp11_console_find_port(ini_path);
+
+  if (mode == NULL) {
+    mode = isatty(STDIN_FILENO) ? "tty" : "none";
+  }
+  if (mux_dir == NULL) {
+    mux_dir = "/run/pidp11";
+  }
+  if (pidp11_console_init(console)) {
+    fprintf(stderr, "Could not set up the console bridge.\n");
+    return -1;
+  }
+
+  if (strcmp(mode, "none") == 0 || port <= 0) {
+    // Leave the console to another client.
+  } else if (strcmp(mode, "pty") == 0) {
+    pidp11_console_line_t *line =
+        pidp11_console_add_pty(console, port, getenv("PIDP11_CONSOLE_LINK"));
+    if (line != NULL) {
+      printf("Console on %s.\n", line->link[0] ? line->link : line->name);
+    } else {
+      fprintf(stderr, "Could not open a pty for the console.\n");
+    }
+  } else if (pidp11_console_add_tty(console, port) == 0) {
+    printf("Console on this terminal. Type ^] to quit.\n");
+  } else {
+    fprintf(stderr, "Could not open the terminal for the console.\n");
+  }
+
+  if (strcmp(mux_dir, "none") != 0) {
+    int first = console->n_lines;
+    pidp11_console_add_muxes(console, ini_path, mux_dir);
+    for (int i = first; i < console->n_lines; i++) {
+      pidp11_console_line_t *line = &console->lines[i];
+      printf("Terminal line %d on %s.\n", i - first,
+             line->link[0] ? line->link : line->name);
+    }
+  }
+
+  if (console->n_lines == 0 || pidp11_console_start(console)) {
+    pidp11_console_stop(console);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Read words of memory: one with a memory examine, or a range with one
+ * examine command.
+ */
+static int fetch_words(void *context, uint32_t address, size_t n_words,
+                       uint16_t *words) {
+  PANEL *panel = (PANEL *)context;
+  if (n_words == 1) {
+    return sim_panel_mem_examine(panel, sizeof(address), &address,
+                                 sizeof(*words), words);
+  }
+  char *response = NULL;
+  int status = 0;
+  int result = _panel_sendf(panel, &status, &response, "EXAMINE %o-%o\r",
+                            address, address + 2 * (uint32_t)(n_words - 1));
+  if (result == 0 &&
+      (status != 0 ||
+       pidp11_memory_parse(response, address, n_words, words) != n_words)) {
+    result = -1;
+  }
+  free(response);
+  return result;
+}
+
+static int examine_word(void *context, uint32_t address, uint16_t *value) {
+  return fetch_words(context, address, 1, value);
+}
+
+static int store_word(void *context, uint32_t address, uint16_t value) {
+  return sim_panel_mem_deposit((PANEL *)context, sizeof(address), &address,
+                               sizeof(value), &value);
+}
+
+static int store_register(void *context, const char *name, uint16_t value) {
+  return sim_panel_gen_deposit((PANEL *)context, name, sizeof(value), &value);
+}
+
+/**
+ * Deposit a program word by word, for when there is no script to run.
+ */
+static int deposit_words(PANEL *panel, const pidp11_image_t *image) {
+  for (size_t i = 0; i < image->n_runs; i++) {
+    const pidp11_load_run_t *run = &image->runs[i];
+    for (size_t j = 0; j < run->n_words; j++) {
+      uint32_t address = run->address + 2 * j;
+      if (sim_panel_mem_deposit(panel, sizeof(address), &address,
+                                sizeof(run->words[j]), &run->words[j])) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * Deposit a program as a script that the simulator runs in one round trip,
+ * rather than a round trip per word.
+ */
+static int deposit_program(PANEL *panel, const pidp11_image_t *image) {
+  char script[] = "/tmp/pidp11-load-XXXXXX";
+  int fd = mkstemp(script);
+  if (fd < 0) {
+    return deposit_words(panel, image);
+  }
+  FILE *out = fdopen(fd, "w");
+  if (out == NULL) {
+    close(fd);
+    unlink(script);
+    return deposit_words(panel, image);
+  }
+  int result = pidp11_image_write_script(image, out);
+  if (fclose(out)) {
+    result = -1;
+  }
+  int status = 0;
+  if (result == 0 && (_panel_sendf(panel, &status, NULL, "DO %s\r", script) ||
+                      status != 0)) {
+    result = -1;
+  }
+  unlink(script);
+  return result;
+}
+
+/**
+ * Read a program back with one examine per run, and compare it.
+ *
+ * @return the number of words that differ, or -1 if it could not be read.
+ */
+static long verify_program(PANEL *panel, const pidp11_image_t *image) {
+  long bad = 0;
+  for (size_t i = 0; i < image->n_runs; i++) {
+    const pidp11_load_run_t *run = &image->runs[i];
+    uint32_t last = run->address + 2 * (run->n_words - 1);
+    char *response = NULL;
+    int status = 0;
+    if (_panel_sendf(panel, &status, &response, "EXAMINE %o-%o\r",
+                     run->address, last) ||
+        status != 0) {
+      free(response);
+      return -1;
+    }
+    bad += pidp11_image_check_run(run, response, stderr);
+    free(response);
+  }
+  return bad;
+}
+
+/**
+ * Load a program from an absolute loader tape or an octal listing into the
+ * halted simulator. If it has a start address, put that in the PC and on
+ * the address lamps, ready for START.
+ *
+ * @param[in] panel The simulator.
+ * @param[in] pidp11 The front panel.
+ * @param[in] path The path to the program.
+ * @param[in] verify Whether to read the program back and compare it.
+ * @return zero on success.
+ */
+int load_program(PANEL *panel, pidp11_t *pidp11, const char *path,
+                 int verify) {
+  pidp11_image_t image;
+  int error_line;
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pidp11_image_init(&image);
+  if (pidp11_image_read(&image, path, &error_line)) {
+    if (error_line > 0) {
+      fprintf(stderr, "%s:%d: bad address or word.\n", path, error_line);
+    } else {
+      fprintf(stderr, "Could not read a program from %s.\n", path);
+    }
+    pidp11_image_free(&image);
+    return -1;
+  }
+
+  if (sim_panel_get_state(panel) == Run) {
+    sim_panel_exec_halt(panel);
+  }
+  // SimH deposits whole words, so fill in any bytes a tape leaves alone.
+  if (pidp11_image_fill(&image, examine_word, panel) ||
+      deposit_program(panel, &image)) {
+    fprintf(stderr, "Could not deposit %s: %s\n", path,
+            sim_panel_get_error());
+    pidp11_image_free(&image);
+    return -1;
+  }
+  long bad = verify ? verify_program(panel, &image) : 0;
+  if (image.has_start) {
+    uint32_t address = image.start;
+    sim_panel_gen_deposit(panel, "PC", sizeof(address), &address);
+    load_address(pidp11, address);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("Loaded %zu words from %s in %.1f ms", pidp11_image_words(&image),
+         path,
+         ((end.tv_sec - start.tv_sec) * 1e9 + end.tv_nsec - start.tv_nsec) /
+             1e6);
+  if (image.has_start) {
+    printf(", start %o", image.start);
+  }
+  printf(verify && bad == 0 ? ", verified.\n" : ".\n");
+  pidp11_image_free(&image);
+  if (bad != 0) {
+    fprintf(stderr, bad < 0 ? "Could not verify %s.\n"
+                            : "%s differs from memory.\n",
+            path);
+    return -1;
+  }
+  return 0;
+}
+
 int main(int argc, char **argv) {
-  gpio_t gpio = {0};
-  bcm2835_gpio_ext_t ext = {0};
+  gpio_device_t device;
   pidp11_t pidp11 = {0};
+  pidp11_telemetry_t telemetry;
+  pidp11_glow_t sampled_glow;
+  pidp11_memory_t memory;
+  // Static, as the bridge's line buffers are too big for the stack.
+  static pidp11_console_t console;
+  const char *telemetry_path = getenv("PIDP11_TELEMETRY");
+  const char *gpio_name = gpio_fast_device_name(getenv("PIDP11_GPIO"));
 
   if (argc < 3) {
     fprintf(stderr, "Usage: %s {sim_path} {ini_path}\n", argv[0]);
     return -1;
   }
+  if (gpio_name == NULL) {
+    fprintf(stderr, "PIDP11_GPIO does not name a device for the %s build.\n",
+            GPIO_FAST_MODE);
+    return -1;
+  }
+  // The GPIO emulator only models one thread's register accesses, and the
+  // display update thread is not the one that configures the panel.
+  if (gpio_name != NULL && strncmp(gpio_name, "emu-", 4) == 0) {
+    fprintf(stderr, "The GPIO emulator is single-threaded; use it with "
+                    "pidp11-off or pidp11-bench.\n");
+    return -1;
+  }
 
   struct sigaction sigint_action = {.sa_handler = sigint_handler,
                                     .sa_flags = 0};
@@ -112,10 +622,20 @@ int main(int argc, char **argv) {
     fprintf(stderr, "Could not install SIGTERM signal handler.\n");
     return -1;
   }
+  // A telemetry client or simulator line that goes away mid-write fails the
+  // write, rather than killing pidp11 with the lamps still lit.
+  struct sigaction sigpipe_action = {.sa_handler = SIG_IGN, .sa_flags = 0};
+  if (sigaction(SIGPIPE, &sigpipe_action, NULL)) {
+    fprintf(stderr, "Could not ignore SIGPIPE.\n");
+    return -1;
+  }
+
+  // sim_panel_start_simulator blocks until something connects to the
+  // console port, so start the console bridge first. Without it, connect
+  // with a telnet client, such as nc.
+  int console_running = start_console(&console, argv[2]) == 0;
 
   printf("Starting simulator.\n");
-  // NOTE: sim_panel_start_simulator blocks until something connects to the
-  // console port. We could spawn a thread and wait, and open a connection here.
 #ifdef DEBUG
   PANEL *panel =
       sim_panel_start_simulator_debug(argv[1], argv[2], 0, "pidp11-debug.log");
@@ -125,6 +645,9 @@ int main(int argc, char **argv) {
 
   if (!panel) {
     fprintf(stderr, "Could not start simulator.  %s\n", sim_panel_get_error());
+    if (console_running) {
+      pidp11_console_stop(&console);
+    }
     return -1;
   }
 #ifdef DEBUG
@@ -133,19 +656,111 @@ int main(int argc, char **argv) {
 
   printf("Simulator started.\n");
 
-  int mem_fd = open("/dev/gpiomem", O_RDWR | O_SYNC);
-  size_t mem_length = 0x100;
-  volatile uint32_t *base = (uint32_t *)mmap(
-      NULL, mem_length, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
-  close(mem_fd);
+  if (gpio_device_open(&device, gpio_name)) {
+    fprintf(stderr, "Could not open GPIO device.\n");
+    sim_panel_destroy(panel);
+    if (console_running) {
+      pidp11_console_stop(&console);
+    }
+    return -1;
+  }
+  if (getenv("PIDP11_GPIO_STATS") != NULL &&
+      gpio_device_enable_stats(&device)) {
+    fprintf(stderr, "Could not enable GPIO statistics.\n");
+  }
+  pidp11_configure(&pidp11, &device.gpio);
+  pidp11_load_env(&pidp11);
+  if (pidp11_start(&pidp11)) {
+    fprintf(stderr, "Could not start the display update thread.\n");
+    sim_panel_destroy(panel);
+    gpio_device_close(&device);
+    if (console_running) {
+      pidp11_console_stop(&console);
+    }
+    return -1;
+  }
+
+  state_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (state_fd < 0 || epoll_fd < 0 || watch_fd(epoll_fd, state_fd) ||
+      watch_fd(epoll_fd, pidp11.event_fd)) {
+    fprintf(stderr, "Could not set up the event loop.\n");
+    sim_panel_destroy(panel);
+    pidp11_close(&pidp11);
+    gpio_device_close(&device);
+    if (console_running) {
+      pidp11_console_stop(&console);
+    }
+    return -1;
+  }
 
-  ext.base = base;
-  bcm2835_gpio_init(&gpio, &ext);
-  pidp11_init(&pidp11, &gpio);
+  if (telemetry_path != NULL &&
+      pidp11_telemetry_start(&telemetry, &pidp11, telemetry_path)) {
+    fprintf(stderr, "Could not listen on %s.\n", telemetry_path);
+    telemetry_path = NULL;
+  }
 
   sim_panel_add_register(panel, "PC", NULL, sizeof(reg_pc), &reg_pc);
   sim_panel_add_register(panel, "R0", NULL, sizeof(reg_pc), &reg_r0);
   sim_panel_add_register(panel, "DR", NULL, sizeof(reg_dr), &reg_dr);
+  sim_panel_add_register(panel, "PSW", NULL, sizeof(reg_psw), &reg_psw);
+  sim_panel_add_register(panel, "FPS", NULL, sizeof(reg_fps), &reg_fps);
+
+  // The memory management registers are sampled with the rest, and only
+  // translated again when they change.
+  pidp11_mmu_init(&mmu);
+  sim_panel_add_register(panel, "MMR0", NULL, sizeof(mmu.mmr0), &mmu.mmr0);
+  sim_panel_add_register(panel, "MMR3", NULL, sizeof(mmu.mmr3), &mmu.mmr3);
+  for (int mode = 0; mode < PIDP11_MMU_MODES; mode++) {
+    for (int space = 0; space < PIDP11_MMU_SPACES; space++) {
+      for (int page = 0; page < PIDP11_MMU_PAGES; page++) {
+        char name[8];
+        pidp11_mmu_register_name(mode, space, page, 0, name, sizeof name);
+        sim_panel_add_register(panel, name, NULL, sizeof(uint16_t),
+                               &mmu.par[mode][space][page]);
+        pidp11_mmu_register_name(mode, space, page, 1, name, sizeof name);
+        sim_panel_add_register(panel, name, NULL, sizeof(uint16_t),
+                               &mmu.pdr[mode][space][page]);
+      }
+    }
+  }
+
+  // The general registers are sampled with the rest, so examining them
+  // needs no round trip.
+  pidp11_memory_init(&memory, fetch_words, store_word, store_register, panel);
+  for (int i = 0; i < PIDP11_MEMORY_REGISTERS; i++) {
+    const char *name = pidp11_memory_register_name(i);
+    if (strcmp(name, "PC") == 0) {
+      memory.registers[i] = &reg_pc;
+    } else if (sim_panel_add_register(panel, name, NULL, sizeof(reg_gr[i]),
+                                      &reg_gr[i]) == 0) {
+      memory.registers[i] = &reg_gr[i];
+    }
+  }
+
+  const char *program = getenv("PIDP11_LOAD");
+  if (program != NULL) {
+    load_program(panel, &pidp11, program,
+                 getenv("PIDP11_LOAD_VERIFY") != NULL);
+  }
+
+  // Sample the bits behind the address and data lamps, if the simulator
+  // can. The sampling parameters have to be set before the bits are added.
+  pidp11_glow_init(&sampled_glow);
+  pidp11_glow_load_env(&sampled_glow);
+  if (sampled_glow.sample_interval > 0) {
+    if (sim_panel_set_sampling_parameters_ex(
+            panel, sampled_glow.sample_interval, 5,
+            sampled_glow.sample_depth) == 0 &&
+        sim_panel_add_register_bits(panel, "PC", NULL, 16, pc_bits) == 0 &&
+        sim_panel_add_register_bits(panel, "R0", NULL, 16, r0_bits) == 0 &&
+        sim_panel_add_register_bits(panel, "DR", NULL, 16, dr_bits) == 0) {
+      glow = &sampled_glow;
+    } else {
+      fprintf(stderr, "Could not sample register bits: %s\n",
+              sim_panel_get_error());
+    }
+  }
   sim_panel_set_display_callback_interval(panel, display_callback, &pidp11,
                                           1000000 / 60); // 60Hz
 
@@ -155,77 +770,120 @@ int main(int argc, char **argv) {
   int prev_cont = 0;
   int prev_start = 0;
   enum step_t step = None;
+  uint64_t console_sent = 0;
   while (!interrupt) {
-    switch (panel->State) {
-    case Run:
-      if (pidp11.switch_ena_halt) {
-        printf("Halt (PC: %o)\n", reg_pc);
-        sim_panel_exec_halt(panel);
-        update_display(&pidp11);
-      }
-      break;
-    case Halt:
-      if (rising_edge(pidp11.switch_load_add, &prev_load_add)) {
-        step = None;
-        pidp11.address = pidp11.switch_reg;
-        printf("Load address %o\n", pidp11.address);
+    int state_changed = wait_for_events(epoll_fd, panel->State == Run);
+
+    // Memory may have changed since the last examine if the simulator ran or
+    // stepped, or took a command, such as DEPOSIT, typed at its prompt.
+    uint64_t sent =
+        console_running ? pidp11_console_bytes_sent(&console) : console_sent;
+    if (state_changed || panel->State == Run || sent != console_sent) {
+      pidp11_memory_invalidate(&memory);
+      console_sent = sent;
+    }
+
+    // Act on each queued switch event in turn. With none queued, the state
+    // changed, so act on the switches as they are.
+    pidp11_event_t event;
+    if (!pidp11_read_event(&pidp11, &event)) {
+      event.switches = pidp11_get_switches(&pidp11, NULL);
+      event.changed = 0;
+    }
+    do {
+      uint64_t switches = event.switches;
+      uint64_t changed = event.changed;
+      if (pidp11_turn_selectors(&pidp11, switches) && panel->State != Run) {
+        update_display(&pidp11, 0);
       }
+      switch (panel->State) {
+      case Run:
+        if (switches & PIDP11_SWITCH_ENA_HALT) {
+          // The panel thread updates the registers while the simulator runs,
+          // so only read them once it has halted.
+          sim_panel_exec_halt(panel);
+          printf("Halt (PC: %o)\n", reg_pc);
+          update_display(&pidp11, 0);
+        }
+        break;
+      case Halt:
+        if (rising_edge(switches, changed, PIDP11_SWITCH_LOAD_ADD,
+                        &prev_load_add)) {
+          step = None;
+          uint32_t address = switches & PIDP11_SWITCH_REG;
+          load_address(&pidp11, address);
+          printf("Load address %o\n", address);
+        }
 
-      if (rising_edge(pidp11.switch_exam, &prev_exam)) {
-        if (step == Exam) {
-          // TODO: check if we're at a GR address
-          pidp11.address += 2;
+        if (rising_edge(switches, changed, PIDP11_SWITCH_EXAM, &prev_exam)) {
+          uint32_t address = step_address(&pidp11, step == Exam);
+          step = Exam;
+          uint16_t value;
+          uint32_t physical;
+          if (console_physical(&pidp11, address, 0, &physical)) {
+            printf("Address error %o\n", address);
+          } else if (pidp11_memory_examine(&memory, physical, &value)) {
+            printf("Could not examine %o\n", physical);
+          } else {
+            printf("Examine %o: %06o\n", address, value);
+            if (pidp11.data_mode == DATA_PATHS) {
+              set_data(&pidp11, value);
+            } else {
+              update_data(&pidp11);
+            }
+          }
         }
-        step = Exam;
-        uint16_t value;
-        sim_panel_mem_examine(panel, sizeof(pidp11.address), &pidp11.address,
-                              sizeof(value), &value);
-        printf("Examine %o: %06o\n", pidp11.address, value);
-        pidp11.data = value; // TODO: if data select switch is DATA PATHS
-      }
-      if (rising_edge(pidp11.switch_dep, &prev_dep)) {
-        if (step == Dep) {
-          // TODO: check if we're at a GR address
-          pidp11.address += 2;
+        if (rising_edge(switches, changed, PIDP11_SWITCH_DEP, &prev_dep)) {
+          uint32_t address = step_address(&pidp11, step == Dep);
+          step = Dep;
+          uint16_t value = switches & PIDP11_SWITCH_REG;
+          uint32_t physical;
+          if (console_physical(&pidp11, address, 1, &physical)) {
+            printf("Address error %o\n", address);
+          } else if (pidp11_memory_deposit(&memory, physical, value)) {
+            printf("Could not deposit %o\n", physical);
+          } else {
+            printf("Deposit %o: %06o\n", address, value);
+            if (pidp11.data_mode == DATA_PATHS) {
+              set_data(&pidp11, value);
+            } else {
+              update_data(&pidp11);
+            }
+          }
         }
-        step = Dep;
-        uint16_t value = pidp11.switch_reg;
-        printf("Deposit %o: %06o\n", pidp11.address, value);
-        sim_panel_mem_deposit(panel, sizeof(pidp11.address), &pidp11.address,
-                              sizeof(value), &value);
-        pidp11.data = value; // TODO: if the data select switch is DATA PATHS
-      }
 
-      if (rising_edge(pidp11.switch_cont, &prev_cont)) {
-        step = None;
-        if (pidp11.switch_ena_halt) {
-          printf("Stepping. (PC: %o)\n", reg_pc);
-          sim_panel_exec_step(panel);
-          update_display(&pidp11);
-        } else {
-          printf("Running. (PC: %o)\n", reg_pc);
-          sim_panel_exec_run(panel);
+        if (rising_edge(switches, changed, PIDP11_SWITCH_CONT, &prev_cont)) {
+          step = None;
+          pidp11_memory_invalidate(&memory);
+          if (switches & PIDP11_SWITCH_ENA_HALT) {
+            printf("Stepping. (PC: %o)\n", reg_pc);
+            sim_panel_exec_step(panel);
+            update_display(&pidp11, 0);
+          } else {
+            printf("Running. (PC: %o)\n", reg_pc);
+            sim_panel_exec_run(panel);
+          }
         }
-      }
 
-      if (rising_edge(pidp11.switch_start, &prev_start)) {
-        step = None;
-        if (pidp11.switch_ena_halt) {
-          printf("Starting.\n");
-          sim_panel_exec_start(panel);
-        } else {
-          printf("Starting at %o\n", pidp11.address);
-          sim_panel_gen_deposit(panel, "PC", sizeof(pidp11.address),
-                                &pidp11.address);
-          sim_panel_exec_start(panel);
+        if (rising_edge(switches, changed, PIDP11_SWITCH_START, &prev_start)) {
+          step = None;
+          pidp11_memory_invalidate(&memory);
+          if (switches & PIDP11_SWITCH_ENA_HALT) {
+            printf("Starting.\n");
+            sim_panel_exec_start(panel);
+          } else {
+            uint32_t address = step_address(&pidp11, 0);
+            printf("Starting at %o\n", address);
+            sim_panel_gen_deposit(panel, "PC", sizeof(address), &address);
+            sim_panel_exec_start(panel);
+          }
         }
-      }
 
-      break;
-    default:
-      interrupt = 1;
-    }
-    usleep(100000);
+        break;
+      default:
+        interrupt = 1;
+      }
+    } while (!interrupt && pidp11_read_event(&pidp11, &event));
   }
 
   printf("Shutting down.\n");
@@ -233,9 +891,21 @@ int main(int argc, char **argv) {
   sim_panel_flush_debug(panel);
 #endif
   sim_panel_destroy(panel);
+  close(epoll_fd);
+  close(state_fd);
+  if (telemetry_path != NULL) {
+    pidp11_telemetry_stop(&telemetry);
+  }
   pidp11_close(&pidp11);
-  gpio_close(&gpio);
-
-  munmap((void *)base, mem_length);
+  if (console_running) {
+    pidp11_console_stop(&console);
+  }
+  pidp11_print_timing(&pidp11, stderr);
+  if (glow != NULL) {
+    pidp11_glow_print(glow, stderr);
+  }
+  pidp11_memory_print(&memory, stderr);
+  pidp11_mmu_print(&mmu, stderr);
+  gpio_device_close(&device);
   return 0;
 }
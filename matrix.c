@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "matrix.h"
+
+/**
+ * Add a bit to a row: move bit from to bit to, merging it into the
+ * operation that shifts by the same distance, if there is one.
+ *
+ * @param row the row.
+ * @param from the source bit.
+ * @param to the destination bit.
+ * @return zero on success.
+ */
+static int add_bit(matrix_row_t *row, int from, int to) {
+  uint8_t left = to > from ? to - from : 0;
+  uint8_t right = from > to ? from - to : 0;
+  int i;
+
+  for (i = 0; i < row->n_ops; i++) {
+    if (row->ops[i].left == left && row->ops[i].right == right) {
+      break;
+    }
+  }
+  if (i == row->n_ops) {
+    if (row->n_ops == MATRIX_MAX_OPS) {
+      return -1;
+    }
+    row->ops[i].mask = 0;
+    row->ops[i].left = left;
+    row->ops[i].right = right;
+    row->n_ops++;
+  }
+  row->ops[i].mask |= (uint64_t)1 << from;
+  row->mask |= (uint64_t)1 << to;
+  return 0;
+}
+
+int matrix_compile(matrix_t *matrix, const matrix_layout_t *layout) {
+  memset(matrix, 0, sizeof *matrix);
+  if (layout->n_leds > MATRIX_MAX_ROWS || layout->n_rows > MATRIX_MAX_ROWS) {
+    return -1;
+  }
+  matrix->n_leds = layout->n_leds;
+  matrix->n_rows = layout->n_rows;
+  for (int i = 0; i < layout->n_cols; i++) {
+    matrix->col_bits |= (uint64_t)1 << layout->col_pins[i];
+  }
+
+  for (int i = 0; i < layout->n_lamps; i++) {
+    const matrix_lamp_t *lamp = &layout->lamps[i];
+    if (lamp->row < 0 || lamp->row >= layout->n_leds || lamp->col < 0 ||
+        lamp->col + lamp->count > layout->n_cols || lamp->source < 0 ||
+        lamp->source + lamp->count > 64) {
+      return -1;
+    }
+    for (int j = 0; j < lamp->count; j++) {
+      if (add_bit(&matrix->led_rows[lamp->row], lamp->source + j,
+                  layout->col_pins[lamp->col + j])) {
+        return -1;
+      }
+    }
+  }
+
+  for (int i = 0; i < layout->n_switches; i++) {
+    const matrix_switch_t *sw = &layout->switches[i];
+    if (sw->row < 0 || sw->row >= layout->n_rows || sw->col < 0 ||
+        sw->col + sw->count > layout->n_cols || sw->dest < 0 ||
+        sw->dest + sw->count > 64) {
+      return -1;
+    }
+    matrix_row_t *row = &matrix->switch_rows[sw->row];
+    for (int j = 0; j < sw->count; j++) {
+      if (add_bit(row, layout->col_pins[sw->col + j], sw->dest + j)) {
+        return -1;
+      }
+      if (sw->inverted) {
+        row->invert |= (uint64_t)1 << (sw->dest + j);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stdint.h>
+
+#include "gpio.h"
+
+/*
+ * A generic LED and switch matrix. A layout names the column, LED row and
+ * switch row pins, and two tables: which bit of a lamp vector lights the
+ * lamp at each LED row and column, and which bit of a switch vector each
+ * switch row and column reads into. matrix_compile() turns the tables into a
+ * few mask and shift operations per row, one for each distinct distance
+ * between a vector bit and its column pin, so converting a row costs the
+ * same whatever the layout, with no per-lamp or per-switch branches.
+ */
+
+#define MATRIX_MAX_ROWS 8
+#define MATRIX_MAX_OPS 16
+
+/**
+ * Lamp vector bits source to source + count - 1 light the lamps in columns
+ * col to col + count - 1 of an LED row.
+ */
+typedef struct _matrix_lamp_t {
+  int row;
+  int col;
+  int source;
+  int count;
+} matrix_lamp_t;
+
+/**
+ * The switches in columns col to col + count - 1 of a switch row read into
+ * switch vector bits dest to dest + count - 1. A switch reads as a one when
+ * it pulls its column low, or when it does not if it is inverted.
+ */
+typedef struct _matrix_switch_t {
+  int row;
+  int col;
+  int dest;
+  int count;
+  int inverted;
+} matrix_switch_t;
+
+typedef struct _matrix_layout_t {
+  const pin_t *col_pins;
+  int n_cols;
+  const pin_t *led_pins;
+  int n_leds;
+  const pin_t *row_pins;
+  int n_rows;
+  const matrix_lamp_t *lamps;
+  int n_lamps;
+  const matrix_switch_t *switches;
+  int n_switches;
+} matrix_layout_t;
+
+/**
+ * One operation: ((value & mask) << left) >> right.
+ */
+typedef struct _matrix_op_t {
+  uint64_t mask;
+  uint8_t left;
+  uint8_t right;
+} matrix_op_t;
+
+/**
+ * The operations for one row, the bits of the result the row owns, and the
+ * bits to invert.
+ */
+typedef struct _matrix_row_t {
+  int n_ops;
+  matrix_op_t ops[MATRIX_MAX_OPS];
+  uint64_t mask;
+  uint64_t invert;
+} matrix_row_t;
+
+typedef struct _matrix_t {
+  uint64_t col_bits;
+  int n_leds;
+  int n_rows;
+  matrix_row_t led_rows[MATRIX_MAX_ROWS];
+  matrix_row_t switch_rows[MATRIX_MAX_ROWS];
+} matrix_t;
+
+/**
+ * Compile a layout.
+ *
+ * @param[out] matrix The compiled matrix.
+ * @param[in] layout The layout.
+ * @return zero on success, or -1 if the layout names a row, column or bit
+ *         out of range, or needs more than MATRIX_MAX_OPS operations in a
+ *         row.
+ */
+int matrix_compile(matrix_t *matrix, const matrix_layout_t *layout);
+
+static inline uint64_t matrix_apply(const matrix_row_t *row, uint64_t value) {
+  uint64_t bits = 0;
+  for (int i = 0; i < row->n_ops; i++) {
+    bits |= ((value & row->ops[i].mask) << row->ops[i].left) >>
+            row->ops[i].right;
+  }
+  return bits;
+}
+
+/**
+ * Get the column pins for the lit lamps of an LED row.
+ *
+ * @param[in] matrix The compiled matrix.
+ * @param[in] row The LED row.
+ * @param[in] lamps The lamp vector.
+ * @return the column pins of the lit lamps.
+ */
+static inline uint64_t matrix_row_lamps(const matrix_t *matrix, int row,
+                                        uint64_t lamps) {
+  return matrix_apply(&matrix->led_rows[row], lamps);
+}
+
+/**
+ * Decode a switch row read into the switch vector.
+ *
+ * @param[in] matrix The compiled matrix.
+ * @param[in] row The switch row.
+ * @param[in] value The column pins read, with the row driven low.
+ * @param[in] switches The switch vector.
+ * @return the switch vector, with the row's bits replaced.
+ */
+static inline uint64_t matrix_row_switches(const matrix_t *matrix, int row,
+                                           uint64_t value, uint64_t switches) {
+  const matrix_row_t *r = &matrix->switch_rows[row];
+  return (switches & ~r->mask) | (matrix_apply(r, ~value) ^ r->invert);
+}
+#endif
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bcm2711_gpio.h"
+#include "bcm2835_gpio.h"
+#include "gpio_device.h"
+#include "gpio_emu.h"
+#include "gpio_fast.h"
+#include "pidp11.h"
+#include "rp1_gpio.h"
+
+static const long EMU_FRAMES = 100;
+
+/*
+ * Measure the cost of a PiDP-11 refresh cycle, without the LED dwell and
+ * switch settle sleeps. The GPIO registers are plain memory, so this runs on
+ * any host. Build with and without GPIO_BACKEND to compare the gpio_t and
+ * static dispatch modes. Where the GPIO emulator is supported, it also counts
+ * the register accesses each cycle makes. PIDP11_SCAN selects the switch
+ * scanning mode, as it does for pidp11.
+ *
+ * Usage: pidp11-bench [bcm2835|bcm2711|rp1|gpiochipN] [frames]
+ */
+
+static uint64_t elapsed_ns(struct timespec *start, struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) * 1000000000ULL + end->tv_nsec -
+         start->tv_nsec;
+}
+
+static void init_registers(gpio_t *gpio, bcm2835_gpio_ext_t *ext,
+                           rp1_gpio_ext_t *rp1_ext, gpio_emu_model_t model,
+                           volatile uint32_t *base) {
+  ext->base = base;
+  rp1_ext->base = base;
+  if (model == GPIO_EMU_RP1) {
+    rp1_gpio_init(gpio, rp1_ext);
+  } else if (model == GPIO_EMU_BCM2711) {
+    bcm2711_gpio_init(gpio, ext);
+  } else {
+    bcm2835_gpio_init(gpio, ext);
+  }
+}
+
+static void setup(pidp11_t *pidp11, gpio_t *gpio) {
+  pidp11_configure(pidp11, gpio);
+  pidp11_load_env(pidp11);
+  pidp11->row_usec = 0;
+  pidp11->settle_usec = 0;
+  pidp11->events_armed = 0;
+  pidp11_lock_lamps(pidp11);
+  pidp11->address = 0123456;
+  pidp11->data = 0177777;
+  pidp11_unlock_lamps(pidp11);
+}
+
+static void run(pidp11_t *pidp11, const char *backend, long frames) {
+  struct timespec start, end, cpu_start, cpu_end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+  for (long i = 0; i < frames; i++) {
+    pidp11_refresh(pidp11);
+  }
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("backend: %s, dispatch: %s, scan: %s, frames: %ld\n", backend,
+         GPIO_FAST_MODE,
+         (pidp11->scan_flags & PIDP11_SCAN_EVENTS) ? "events" : "full",
+         frames);
+  printf("wall: %.1f ns/frame, cpu: %.1f ns/frame\n",
+         (double)elapsed_ns(&start, &end) / frames,
+         (double)elapsed_ns(&cpu_start, &cpu_end) / frames);
+}
+
+/*
+ * The gpiochip backend makes system calls, so it is measured against a real
+ * or gpio-sim chip, and reports the system calls each cycle makes.
+ */
+static int run_gpiochip(pidp11_t *pidp11, const char *backend, long frames) {
+  gpio_device_t device;
+
+  if (gpio_device_open(&device, backend)) {
+    fprintf(stderr, "Could not open /dev/%s.\n", backend);
+    return -1;
+  }
+  setup(pidp11, &device.gpio);
+  device.gpiochip.syscalls = 0;
+  run(pidp11, backend, frames);
+  printf("syscalls: %.1f/frame\n",
+         (double)device.gpiochip.syscalls / frames);
+  gpio_device_close(&device);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  gpio_t gpio = {0};
+  bcm2835_gpio_ext_t ext = {0};
+  rp1_gpio_ext_t rp1_ext = {0};
+  pidp11_t pidp11 = {0};
+
+#ifdef GPIO_BACKEND
+  const char *backend = GPIO_FAST_NAME(GPIO_BACKEND);
+#else
+  const char *backend = "bcm2835";
+#endif
+  long frames = 10000;
+
+  if (argc > 1) {
+    backend = argv[1];
+  }
+  if (argc > 2) {
+    frames = atol(argv[2]);
+  }
+
+#ifdef GPIO_BACKEND
+  if (strncmp(backend, GPIO_FAST_NAME(GPIO_BACKEND),
+              strlen(GPIO_FAST_NAME(GPIO_BACKEND))) != 0) {
+    fprintf(stderr, "This build only supports the %s backend.\n",
+            GPIO_FAST_NAME(GPIO_BACKEND));
+    return -1;
+  }
+#endif
+
+  gpio_emu_model_t model;
+  if (strcmp(backend, "bcm2835") == 0) {
+    model = GPIO_EMU_BCM2835;
+  } else if (strcmp(backend, "bcm2711") == 0) {
+    model = GPIO_EMU_BCM2711;
+  } else if (strcmp(backend, "rp1") == 0) {
+    model = GPIO_EMU_RP1;
+  } else if (strncmp(backend, "gpiochip", strlen("gpiochip")) == 0) {
+    return run_gpiochip(&pidp11, backend, frames);
+  } else {
+    fprintf(stderr, "Usage: %s [bcm2835|bcm2711|rp1|gpiochipN] [frames]\n",
+            argv[0]);
+    return -1;
+  }
+
+  static uint32_t registers[0x30000 >> 2];
+  init_registers(&gpio, &ext, &rp1_ext, model, registers);
+  setup(&pidp11, &gpio);
+  run(&pidp11, backend, frames);
+  gpio_close(&gpio);
+
+  gpio_emu_t emu;
+  if (gpio_emu_open(&emu, model) == 0) {
+    init_registers(&gpio, &ext, &rp1_ext, model, emu.base);
+    setup(&pidp11, &gpio);
+    gpio_emu_reset_counts(&emu);
+    for (long i = 0; i < EMU_FRAMES; i++) {
+      pidp11_refresh(&pidp11);
+    }
+    uint64_t reads, writes;
+    gpio_emu_get_counts(&emu, &reads, &writes);
+    printf("mmio: %.1f reads/frame, %.1f writes/frame\n",
+           (double)reads / EMU_FRAMES, (double)writes / EMU_FRAMES);
+    gpio_close(&gpio);
+    gpio_emu_close(&emu);
+  } else {
+    printf("mmio: not counted, the GPIO emulator is not supported here\n");
+  }
+  return 0;
+}
@@ -20,31 +20,34 @@
  * IN THE SOFTWARE.
  */
 
-#include <fcntl.h>
-#include <sys/mman.h>
-#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
 
-#include "bcm2835_gpio.h"
+#include "gpio_device.h"
+#include "gpio_fast.h"
 #include "pidp11.h"
 
 int main(int argc, char **argv) {
-  gpio_t gpio = {0};
-  bcm2835_gpio_ext_t ext = {0};
+  gpio_device_t device;
   pidp11_t pidp11 = {0};
+  const char *gpio_name = gpio_fast_device_name(getenv("PIDP11_GPIO"));
 
-  int mem_fd = open("/dev/gpiomem", O_RDWR | O_SYNC);
-  size_t mem_length = 0x100;
-  volatile uint32_t *base = (uint32_t *)mmap(
-      NULL, mem_length, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
-  close(mem_fd);
-
-  ext.base = base;
-  bcm2835_gpio_init(&gpio, &ext);
-  pidp11_init(&pidp11, &gpio);
+  if (gpio_name == NULL) {
+    fprintf(stderr, "PIDP11_GPIO does not name a device for the %s build.\n",
+            GPIO_FAST_MODE);
+    return -1;
+  }
+  if (gpio_device_open(&device, gpio_name)) {
+    fprintf(stderr, "Could not open GPIO device.\n");
+    return -1;
+  }
+  if (getenv("PIDP11_GPIO_STATS") != NULL &&
+      gpio_device_enable_stats(&device)) {
+    fprintf(stderr, "Could not enable GPIO statistics.\n");
+  }
+  pidp11_init(&pidp11, &device.gpio);
 
   pidp11_close(&pidp11);
-  gpio_close(&gpio);
-
-  munmap((void *)base, mem_length);
+  gpio_device_close(&device);
   return 0;
 }
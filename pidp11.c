@@ -20,10 +20,20 @@
  * IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "gpio.h"
+#include "gpio_fast.h"
+#include "matrix.h"
 #include "pidp11.h"
 
 static pin_t col_pins[] = {26, 27, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13};
@@ -33,10 +43,390 @@ static int n_led_pins = sizeof led_pins / sizeof led_pins[0];
 static int n_col_pins = sizeof col_pins / sizeof col_pins[0];
 static int n_row_pins = sizeof row_pins / sizeof row_pins[0];
 
+// The row with the momentary switches, watched between frames in
+// PIDP11_SCAN_EVENTS mode, and the columns of its momentary switches: LOAD
+// ADDR, EXAM, DEP, CONT and START.
+static const int watch_row = 2;
+static const uint64_t momentary_bits =
+    (1 << 27) | (1 << 4) | (1 << 5) | (1 << 6) | (1 << 9);
+static const uint64_t momentary_switches =
+    PIDP11_SWITCH_LOAD_ADD | PIDP11_SWITCH_EXAM | PIDP11_SWITCH_DEP |
+    PIDP11_SWITCH_CONT | PIDP11_SWITCH_START;
+
+// The positions of the ADDRESS and DATA selectors.
+static const int n_addr_modes = ADDR_USER_I + 1;
+static const int n_data_modes = DATA_DISP_REG + 1;
+
+// The frame period while the lamps are blanked, which only scans the
+// switches.
+static const unsigned int blank_frame_usec = 50000;
+
+// The stack the display update thread touches before it starts, so it does
+// not page fault in the refresh loop once memory is locked.
+static const size_t prefault_stack_size = 64 * 1024;
+
+static int64_t now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Sleep until an absolute CLOCK_MONOTONIC deadline. Unlike a relative sleep,
+ * a late wakeup does not push back the deadlines that follow it.
+ *
+ * @param deadline the deadline, in nanoseconds.
+ */
+static void sleep_until(int64_t deadline) {
+  struct timespec ts = {.tv_sec = deadline / 1000000000,
+                        .tv_nsec = deadline % 1000000000};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+/**
+ * Wait until a modulation slot's deadline: busy-wait if it is due within
+ * spin_ns, since a sleep that short would overshoot it, and sleep otherwise.
+ *
+ * @param deadline the deadline, in nanoseconds.
+ * @param spin_ns the longest wait to busy-wait, in nanoseconds.
+ */
+static void wait_until(int64_t deadline, int64_t spin_ns) {
+  if (deadline - now_ns() > spin_ns) {
+    sleep_until(deadline);
+    return;
+  }
+  while (now_ns() < deadline)
+    ;
+}
+
+// Lamp vector bits: the address, the data, then the lamps of row 2, the
+// lamps of row 4 after D15, and the lamps of row 5. See pidp11_lamp_vector().
+static const int lamp_data = 22;
+static const int lamp_status = 38;
+static const int lamp_modes = 50;
+static const int lamp_modes_i = 58;
+
+// The PiDP-11 front panel, as data. Row 1 has A12 to A21, and row 5 starts
+// at column 6.
+static const matrix_lamp_t pidp11_lamps[] = {
+    {0, 0, 0, 12}, {1, 0, 12, 10}, {2, 0, 38, 12}, {3, 0, 22, 12},
+    {4, 0, 34, 4}, {4, 4, 50, 8},  {5, 6, 58, 6},
+};
+
+// Row 0 has SR0 to SR11, row 1 SR12 to SR21 and the ADDR and DATA switches,
+// and row 2 the TEST switch, which is inverted, and the rest of the controls.
+static const matrix_switch_t pidp11_switches[] = {
+    {0, 0, 0, 12, 0},  {1, 0, 12, 10, 0}, {1, 10, 30, 1, 0},
+    {1, 11, 33, 1, 0}, {2, 0, 22, 1, 1},  {2, 1, 23, 7, 0},
+    {2, 8, 31, 2, 0},  {2, 10, 34, 2, 0},
+};
+
+static const matrix_layout_t pidp11_layout = {
+    .col_pins = col_pins,
+    .n_cols = sizeof col_pins / sizeof col_pins[0],
+    .led_pins = led_pins,
+    .n_leds = sizeof led_pins / sizeof led_pins[0],
+    .row_pins = row_pins,
+    .n_rows = sizeof row_pins / sizeof row_pins[0],
+    .lamps = pidp11_lamps,
+    .n_lamps = sizeof pidp11_lamps / sizeof pidp11_lamps[0],
+    .switches = pidp11_switches,
+    .n_switches = sizeof pidp11_switches / sizeof pidp11_switches[0],
+};
+
+static matrix_t matrix;
+
+/**
+ * Pack the lamp state into a lamp vector, one bit per lamp.
+ *
+ * @param state the lamp state.
+ * @return the lamp vector.
+ */
+static uint64_t pidp11_lamp_vector(const pidp11_lamp_state_t *state) {
+  uint64_t status =
+      (state->addressing_length == ADDRESS_22) << 0 |
+      (state->addressing_length == ADDRESS_18) << 1 |
+      (state->addressing_length == ADDRESS_16) << 2 |
+      (state->data_ref != 0) << 3 | (state->run_level == RUN_LEVEL_KERNEL) << 4 |
+      (state->run_level == RUN_LEVEL_SUPER) << 5 |
+      (state->run_level == RUN_LEVEL_USER) << 6 |
+      (state->run_state == RUN_STATE_MASTER) << 7 |
+      (state->run_state == RUN_STATE_PAUSE) << 8 |
+      (state->run_state == RUN_STATE_RUN) << 9 |
+      (state->address_err != 0) << 10 | (state->parity_err != 0) << 11;
+  uint64_t modes = (state->parity_low != 0) << 0 |
+                   (state->parity_high != 0) << 1 |
+                   (state->addr_mode == ADDR_USER_D) << 2 |
+                   (state->addr_mode == ADDR_SUPER_D) << 3 |
+                   (state->addr_mode == ADDR_KERNEL_D) << 4 |
+                   (state->addr_mode == ADDR_CONS_PHY) << 5 |
+                   (state->data_mode == DATA_PATHS) << 6 |
+                   (state->data_mode == DATA_BUS_REG) << 7;
+  uint64_t modes_i = (state->addr_mode == ADDR_USER_I) << 0 |
+                     (state->addr_mode == ADDR_SUPER_I) << 1 |
+                     (state->addr_mode == ADDR_KERNEL_I) << 2 |
+                     (state->addr_mode == ADDR_PROG_PHY) << 3 |
+                     (state->data_mode == DATA_MU_A_FPP_CPU) << 4 |
+                     (state->data_mode == DATA_DISP_REG) << 5;
+  return (state->address & 0x3fffff) |
+         (uint64_t)(state->data & 0xffff) << lamp_data |
+         status << lamp_status | modes << lamp_modes |
+         modes_i << lamp_modes_i;
+}
+
+/**
+ * Read the published lamp snapshot. Retries while a writer is publishing, and
+ * never blocks.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ * @param state the snapshot.
+ * @return the snapshot's sequence number.
+ */
+static unsigned int pidp11_read_lamps(pidp11_t *pidp11,
+                                      pidp11_lamp_state_t *state) {
+  unsigned int seq;
+  do {
+    seq = atomic_load_explicit(&pidp11->lamp_seq, memory_order_acquire);
+    memcpy(state, &pidp11->lamps, sizeof *state);
+    atomic_thread_fence(memory_order_acquire);
+  } while ((seq & 1) ||
+           seq != atomic_load_explicit(&pidp11->lamp_seq,
+                                       memory_order_relaxed));
+  return seq;
+}
+
+// The lamp vector bits of the lamps that can glow.
+static const uint64_t glow_bits = ((uint64_t)1 << PIDP11_GLOW_LAMPS) - 1;
+
+/**
+ * Dither the glow intensities over the frames: each lamp carries the part of
+ * its intensity it has not yet been lit for, and is lit for this frame once
+ * that reaches a full frame.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ * @return the lamp vector bits of the glowing lamps lit this frame.
+ */
+static uint64_t pidp11_dither_glow(pidp11_t *pidp11) {
+  uint64_t lit = 0;
+  for (int i = 0; i < PIDP11_GLOW_LAMPS; i++) {
+    unsigned int error = pidp11->glow_error[i] + pidp11->compiled_glow[i];
+    unsigned int on = error >= PIDP11_GLOW_MAX;
+    pidp11->glow_error[i] = error - on * PIDP11_GLOW_MAX;
+    lit |= (uint64_t)on << i;
+  }
+  return lit;
+}
+
+/**
+ * Modulate the glow intensities: scale each to bcm_bits bits, and light the
+ * lamp in the slots of its set bits.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ * @param slot_lamps the lamp vector for each slot, with the glowing lamps
+ *                   added.
+ */
+static void pidp11_modulate_glow(pidp11_t *pidp11, uint64_t *slot_lamps) {
+  unsigned int levels = (1u << pidp11->bcm_bits) - 1;
+  for (int i = 0; i < PIDP11_GLOW_LAMPS; i++) {
+    unsigned int level =
+        (pidp11->compiled_glow[i] * levels + PIDP11_GLOW_MAX / 2) /
+        PIDP11_GLOW_MAX;
+    for (unsigned int k = 0; k < pidp11->bcm_bits; k++) {
+      slot_lamps[k] |= (uint64_t)((level >> k) & 1) << i;
+    }
+  }
+}
+
+/**
+ * Compile the published lamps into the column pins to set and clear for each
+ * LED row and modulation slot. Does nothing if neither the lamps nor the
+ * lamp test switch have changed since the last compile, unless the lamps
+ * are dithered.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ */
+static void pidp11_compile_lamps(pidp11_t *pidp11) {
+  char test = (pidp11->debounced_switches & PIDP11_SWITCH_TEST) != 0;
+  char dither = pidp11->compiled_glowing && pidp11->bcm_bits == 0;
+
+  if (!pidp11->lamps_compiled ||
+      atomic_load_explicit(&pidp11->lamp_seq, memory_order_relaxed) !=
+          pidp11->compiled_seq) {
+    pidp11_lamp_state_t state;
+    pidp11->compiled_seq = pidp11_read_lamps(pidp11, &state);
+    pidp11->activity_ns = now_ns();
+    pidp11->compiled_lamps = pidp11_lamp_vector(&state);
+    pidp11->compiled_glowing = state.glowing;
+    memcpy(pidp11->compiled_glow, state.glow, sizeof state.glow);
+  } else if (test == pidp11->compiled_test && !dither) {
+    return;
+  }
+  pidp11->compiled_test = test;
+
+  int slots = pidp11->bcm_bits ? pidp11->bcm_bits : 1;
+  uint64_t lamps = pidp11->compiled_lamps;
+  uint64_t slot_lamps[PIDP11_MAX_BCM_BITS];
+  if (pidp11->compiled_glowing) {
+    lamps &= ~glow_bits;
+    if (pidp11->bcm_bits == 0) {
+      lamps |= pidp11_dither_glow(pidp11);
+    }
+  }
+  for (int k = 0; k < slots; k++) {
+    slot_lamps[k] = lamps;
+  }
+  if (pidp11->compiled_glowing && pidp11->bcm_bits != 0) {
+    pidp11_modulate_glow(pidp11, slot_lamps);
+  }
+
+  for (int i = 0; i < matrix.n_leds; i++) {
+    for (int k = 0; k < slots; k++) {
+      // The lamp test lights every column, wired to a lamp or not.
+      uint64_t lit_pins = test ? matrix.col_bits
+                               : matrix_row_lamps(&matrix, i, slot_lamps[k]);
+      // A lamp is lit when its column is driven low.
+      pidp11->row_set_bits[i][k] = matrix.col_bits & ~lit_pins;
+      pidp11->row_clear_bits[i][k] = lit_pins;
+    }
+  }
+  pidp11->lamps_compiled = 1;
+}
+
+/**
+ * Debounce the switches. A switch change is accepted once the switch has
+ * read the same for debounce_usec; a switch that reads its old state again
+ * before then was bouncing, and its change is dropped.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ * @param switches the switches as scanned.
+ * @param pressed switches to accept as pressed at once.
+ * @param edges switches with an edge time, taken as when they changed.
+ * @param edge_ns the edge times, indexed by switch.
+ * @param time when the earliest accepted change was first seen.
+ * @return the switches whose changes were accepted.
+ */
+static uint64_t pidp11_debounce(pidp11_t *pidp11, uint64_t switches,
+                                uint64_t pressed, uint64_t edges,
+                                const int64_t *edge_ns, int64_t *time) {
+  int64_t now = now_ns();
+  int64_t hold = pidp11->debounce_usec * 1000LL;
+  uint64_t accepted = pressed & ~pidp11->debounced_switches;
+  uint64_t changes = (switches ^ pidp11->debounced_switches) & ~pressed;
+
+  pidp11->pending_switches &= changes;
+  for (uint64_t bits = changes; bits != 0; bits &= bits - 1) {
+    int i = __builtin_ctzll(bits);
+    uint64_t bit = (uint64_t)1 << i;
+    if (!(pidp11->pending_switches & bit)) {
+      pidp11->pending_switches |= bit;
+      pidp11->pending_since[i] = (edges & bit) ? edge_ns[i] : now;
+    }
+    if (now - pidp11->pending_since[i] >= hold) {
+      accepted |= bit;
+    }
+  }
+  *time = now;
+  for (uint64_t bits = accepted; bits != 0; bits &= bits - 1) {
+    int i = __builtin_ctzll(bits);
+    uint64_t bit = (uint64_t)1 << i;
+    int64_t seen = !(pressed & bit) ? pidp11->pending_since[i]
+                   : (edges & bit)  ? edge_ns[i]
+                                    : now;
+    atomic_store_explicit(&pidp11->switch_time_ns[i], seen,
+                          memory_order_relaxed);
+    if (seen < *time) {
+      *time = seen;
+    }
+  }
+  pidp11->pending_switches &= ~accepted;
+  pidp11->debounced_switches ^= accepted;
+  return accepted;
+}
+
+/**
+ * Get when the watched row's switches last changed, from the times the GPIO
+ * device stamped on their column edges, where it has them.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ * @param events the columns with edges latched since the last frame.
+ * @param edge_ns the edge times, indexed by switch.
+ * @return the switches with an edge time.
+ */
+static uint64_t pidp11_edge_times(pidp11_t *pidp11, uint64_t events,
+                                  int64_t *edge_ns) {
+  int64_t pin_ns[64];
+  uint64_t edges = 0;
+
+  if (events == 0 || gpio_get_event_times(pidp11->gpio, events, pin_ns)) {
+    return 0;
+  }
+  // A row read of all ones gives the switches' inverted bits, to cancel.
+  uint64_t invert = matrix_row_switches(&matrix, watch_row, ~(uint64_t)0, 0);
+  int64_t now = now_ns();
+  for (uint64_t bits = events; bits != 0; bits &= bits - 1) {
+    int pin = __builtin_ctzll(bits);
+    if (pin_ns[pin] <= 0 || pin_ns[pin] > now) {
+      continue;
+    }
+    uint64_t pin_switches =
+        matrix_row_switches(&matrix, watch_row, ~((uint64_t)1 << pin), 0) ^
+        invert;
+    for (uint64_t s = pin_switches; s != 0; s &= s - 1) {
+      edge_ns[__builtin_ctzll(s)] = pin_ns[pin];
+    }
+    edges |= pin_switches;
+  }
+  return edges;
+}
+
+/**
+ * Queue a switch event, and signal the event fd.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ * @param event the event.
+ */
+static void pidp11_post_event(pidp11_t *pidp11, const pidp11_event_t *event) {
+  unsigned int head =
+      atomic_load_explicit(&pidp11->event_head, memory_order_relaxed);
+  unsigned int tail =
+      atomic_load_explicit(&pidp11->event_tail, memory_order_acquire);
+
+  if (head - tail == PIDP11_EVENT_QUEUE_SIZE) {
+    atomic_fetch_add_explicit(&pidp11->events_dropped, 1,
+                              memory_order_relaxed);
+    return;
+  }
+  pidp11->events[head % PIDP11_EVENT_QUEUE_SIZE] = *event;
+  atomic_store_explicit(&pidp11->event_head, head + 1, memory_order_release);
+
+  if (pidp11->event_fd >= 0) {
+    uint64_t one = 1;
+    if (write(pidp11->event_fd, &one, sizeof one) != sizeof one) {
+      // The counter is saturated, so the reader is already due to wake.
+    }
+  }
+}
+
+/**
+ * Stop watching the switches between frames.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ */
+static void pidp11_disarm_events(pidp11_t *pidp11) {
+  gpio_clear_enable_event_detect_bits(pidp11->gpio, matrix.col_bits,
+                                      DETECT_RISING | DETECT_FALLING);
+  pidp11->events_armed = 0;
+}
+
 void pidp11_cleanup(void *context) {
   pidp11_t *pidp11 = (pidp11_t *)context;
   gpio_t *gpio = pidp11->gpio;
 
+  if (pidp11->events_armed) {
+    pidp11_disarm_events(pidp11);
+  }
+
   gpio_set_function_pins(gpio, led_pins, n_led_pins, IN);
   gpio_set_function_pins(gpio, col_pins, n_col_pins, IN);
   gpio_set_function_pins(gpio, row_pins, n_row_pins, IN);
@@ -50,178 +440,695 @@ void pidp11_cleanup(void *context) {
                      sizeof default_down / sizeof default_down[0], DOWN);
 }
 
-void *pidp11_update(void *context) {
-  pidp11_t *pidp11 = (pidp11_t *)context;
+/**
+ * Scan the switch rows, and decode the switch states. The columns must be
+ * pulled-up inputs, and the rows high.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ * @param events the columns with edges latched since the last frame.
+ */
+static void pidp11_scan_switches(pidp11_t *pidp11, uint64_t events) {
   gpio_t *gpio = pidp11->gpio;
+  uint64_t switches = pidp11->scanned_switches;
+  uint64_t pulses = 0;
 
-  pthread_cleanup_push(pidp11_cleanup, pidp11);
-  while (1) {
-    gpio_set_function_pins(gpio, col_pins, n_col_pins, OUT);
-    for (int i = 0; i < n_led_pins; i++) {
-      if (pidp11->switch_test) {
-        gpio_set_pins(gpio, col_pins, n_col_pins, 0);
-      } else {
-        switch (i) {
-        case 0:
-          for (int j = 0; j < n_col_pins; j++) {
-            gpio_set_pins(gpio, &col_pins[j], 1, !(pidp11->address & (1 << j)));
-          }
-          break;
-        case 1:
-          for (int j = 0; j < 10; j++) {
-            gpio_set_pins(gpio, &col_pins[j], 1,
-                          !(pidp11->address & (1 << (j + 12))));
-          }
-          break;
-        case 2:
-          gpio_set_pins(gpio, &col_pins[0], 1,
-                        pidp11->addressing_length != ADDRESS_22);
-          gpio_set_pins(gpio, &col_pins[1], 1,
-                        pidp11->addressing_length != ADDRESS_18);
-          gpio_set_pins(gpio, &col_pins[2], 1,
-                        pidp11->addressing_length != ADDRESS_16);
-          gpio_set_pins(gpio, &col_pins[3], 1, !pidp11->data_ref);
-          gpio_set_pins(gpio, &col_pins[4], 1,
-                        pidp11->run_level != RUN_LEVEL_KERNEL);
-          gpio_set_pins(gpio, &col_pins[5], 1,
-                        pidp11->run_level != RUN_LEVEL_SUPER);
-          gpio_set_pins(gpio, &col_pins[6], 1,
-                        pidp11->run_level != RUN_LEVEL_USER);
-          gpio_set_pins(gpio, &col_pins[7], 1,
-                        pidp11->run_state != RUN_STATE_MASTER);
-          gpio_set_pins(gpio, &col_pins[8], 1,
-                        pidp11->run_state != RUN_STATE_PAUSE);
-          gpio_set_pins(gpio, &col_pins[9], 1,
-                        pidp11->run_state != RUN_STATE_RUN);
-          gpio_set_pins(gpio, &col_pins[10], 1, !pidp11->address_err);
-          gpio_set_pins(gpio, &col_pins[11], 1, !pidp11->parity_err);
-          break;
-        case 3:
-          for (int j = 0; j < n_col_pins; j++) {
-            gpio_set_pins(gpio, &col_pins[j], 1, !(pidp11->data & (1 << j)));
-          }
-          break;
-        case 4:
-          for (int j = 0; j < 4; j++) {
-            gpio_set_pins(gpio, &col_pins[j], 1,
-                          !(pidp11->data & (1 << (j + 12))));
-          }
-          gpio_set_pins(gpio, &col_pins[4], 1, !pidp11->parity_low);
-          gpio_set_pins(gpio, &col_pins[5], 1, !pidp11->parity_high);
-          gpio_set_pins(gpio, &col_pins[6], 1,
-                        pidp11->addr_mode != ADDR_USER_D);
-          gpio_set_pins(gpio, &col_pins[7], 1,
-                        pidp11->addr_mode != ADDR_SUPER_D);
-          gpio_set_pins(gpio, &col_pins[8], 1,
-                        pidp11->addr_mode != ADDR_KERNEL_D);
-          gpio_set_pins(gpio, &col_pins[9], 1,
-                        pidp11->addr_mode != ADDR_CONS_PHY);
-          gpio_set_pins(gpio, &col_pins[10], 1,
-                        pidp11->data_mode != DATA_PATHS);
-          gpio_set_pins(gpio, &col_pins[11], 1,
-                        pidp11->data_mode != DATA_BUS_REG);
-          break;
-        case 5:
-          gpio_set_pins(gpio, &col_pins[6], 1,
-                        pidp11->addr_mode != ADDR_USER_I);
-          gpio_set_pins(gpio, &col_pins[7], 1,
-                        pidp11->addr_mode != ADDR_SUPER_I);
-          gpio_set_pins(gpio, &col_pins[8], 1,
-                        pidp11->addr_mode != ADDR_KERNEL_I);
-          gpio_set_pins(gpio, &col_pins[9], 1,
-                        pidp11->addr_mode != ADDR_PROG_PHY);
-          gpio_set_pins(gpio, &col_pins[10], 1,
-                        pidp11->data_mode != DATA_MU_A_FPP_CPU);
-          gpio_set_pins(gpio, &col_pins[11], 1,
-                        pidp11->data_mode != DATA_DISP_REG);
-          break;
-#ifdef DEBUG
-        default:
-          printf("DANGER: There are only six led rows.");
-#endif
+  for (int i = 0; i < n_row_pins; i++) {
+    pin_t row_pin[] = {row_pins[i]};
+    gpio_fast_set_pins(gpio, row_pin, 1, 0);
+    if (pidp11->settle_usec) {
+      sleep_until(now_ns() + pidp11->settle_usec * 1000LL);
+    }
+    uint64_t value;
+    gpio_fast_get_bits(gpio, &value);
+    if (i == watch_row) {
+      // A momentary switch with edges, open now and at the last scan, was
+      // pressed and released in between. Report it pressed for this frame,
+      // and rescan next frame to report the release.
+      pulses = events & momentary_bits & value & pidp11->watch_levels;
+      pidp11->watch_levels = value;
+      value &= ~pulses;
+      if (pulses != 0) {
+        pidp11->scan_countdown = 0;
+      }
+    }
+    switches = matrix_row_switches(&matrix, i, value, switches);
+    gpio_fast_set_pins(gpio, row_pin, 1, 1);
+  }
+
+  pidp11->scanned_switches = switches;
+
+  // A pulse is a press the event detector already saw complete, so it is
+  // accepted without waiting out the debounce time.
+  uint64_t pressed =
+      matrix_row_switches(&matrix, watch_row, ~pulses, 0) & momentary_switches;
+  int64_t edge_ns[PIDP11_N_SWITCHES];
+  uint64_t edges = pidp11_edge_times(pidp11, events, edge_ns);
+  int64_t time;
+  uint64_t changed =
+      pidp11_debounce(pidp11, switches, pressed, edges, edge_ns, &time);
+  if (pidp11->pending_switches != 0) {
+    pidp11->scan_countdown = 0;
+  }
+
+  // Publish the times and switches, then the changes, so a reader that takes
+  // a change sees the switches that made it.
+  if (changed != 0) {
+    pidp11->activity_ns = time;
+    atomic_store_explicit(&pidp11->switches, pidp11->debounced_switches,
+                          memory_order_release);
+    atomic_fetch_or_explicit(&pidp11->switch_changes, changed,
+                             memory_order_release);
+    pidp11_event_t event = {.switches = pidp11->debounced_switches,
+                            .changed = changed,
+                            .time_ns = time};
+    pidp11_post_event(pidp11, &event);
+  }
+}
+
+/**
+ * Hold the momentary switch row low until the next frame, and latch the
+ * edges on the columns while it is. The columns must be pulled-up inputs.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ */
+static void pidp11_watch_switches(pidp11_t *pidp11) {
+  gpio_t *gpio = pidp11->gpio;
+  uint64_t events;
+
+  if (!pidp11->events_armed) {
+    if (gpio_set_enable_event_detect_bits(gpio, matrix.col_bits,
+                                          DETECT_RISING | DETECT_FALLING)) {
+      pidp11->scan_flags &= ~PIDP11_SCAN_EVENTS;
+      return;
+    }
+    pidp11->events_armed = 1;
+  }
+  gpio_fast_set_pins(gpio, &row_pins[watch_row], 1, 0);
+  if (pidp11->settle_usec) {
+    sleep_until(now_ns() + pidp11->settle_usec * 1000LL);
+  }
+  // Discard the edges from driving the columns and the row.
+  gpio_get_and_clear_events(gpio, &events);
+}
+
+void pidp11_refresh(pidp11_t *pidp11) {
+  gpio_t *gpio = pidp11->gpio;
+  uint64_t events = 0;
+  // Each LED row goes dark at a fixed offset from the start of the frame.
+  // At the idle rate, the rows are lit for longer, in proportion to the
+  // longer frame, so the lamps keep their brightness.
+  unsigned int row_usec = pidp11->row_usec;
+  if (pidp11->rate == PIDP11_RATE_IDLE && pidp11->frame_usec) {
+    row_usec = (uint64_t)row_usec * pidp11->idle_frame_usec /
+               pidp11->frame_usec;
+  }
+  int64_t deadline = row_usec ? now_ns() : 0;
+  pidp11->frame_rows = 0;
+
+  // Each row is lit for brightness percent of its time, split into the
+  // modulation slots. slot_end[k] is when slot k ends, from when the row is
+  // lit.
+  int slots = pidp11->bcm_bits ? pidp11->bcm_bits : 1;
+  int64_t row_ns = row_usec * 1000LL;
+  int64_t on_ns = row_ns * pidp11->brightness / 100;
+  int64_t slot_end[PIDP11_MAX_BCM_BITS];
+  for (int k = 0; k < slots; k++) {
+    slot_end[k] = on_ns * ((2 << k) - 1) / ((1 << slots) - 1);
+  }
+
+  if (pidp11->events_armed) {
+    gpio_get_and_clear_events(gpio, &events);
+    events &= matrix.col_bits;
+    // Release the watched row before the columns are driven.
+    gpio_fast_set_pins(gpio, &row_pins[watch_row], 1, 1);
+  }
+  pidp11_compile_lamps(pidp11);
+  gpio_fast_set_function_pins(gpio, col_pins, n_col_pins, OUT);
+  for (int i = 0; i < n_led_pins && pidp11->rate != PIDP11_RATE_BLANK; i++) {
+    uint64_t led_bit = (uint64_t)1 << led_pins[i];
+    int64_t row_start = deadline;
+    int64_t lit = 0;
+    for (int k = 0; k < slots; k++) {
+      gpio_fast_write_masked(gpio, pidp11->row_set_bits[i][k],
+                             pidp11->row_clear_bits[i][k]);
+      if (k == 0) {
+        gpio_fast_set_bits(gpio, led_bit, 1);
+        lit = pidp11->collect_stats ? now_ns() : 0;
+        if (row_usec && lit > row_start + on_ns) {
+          pidp11->frame_missed++;
         }
       }
-      gpio_set_pins(gpio, &led_pins[i], 1, 1);
-
-      usleep((100000 / 60) / 6);
-      gpio_set_pins(gpio, &led_pins[i], 1, 0);
-    }
-    // Capture switch state
-    gpio_set_pins(gpio, row_pins, n_row_pins, 1);
-    gpio_set_pull_pins(gpio, col_pins, n_col_pins, UP);
-    gpio_set_function_pins(gpio, col_pins, n_col_pins, IN);
-    for (int i = 0; i < n_row_pins; i++) {
-      pin_t row_pin[] = {row_pins[i]};
-      gpio_set_pins(gpio, row_pin, 1, 0);
-      usleep(10);
-      uint64_t value;
-      gpio_get_bits(gpio, &value);
-      switch (i) {
-      case 0:
-        pidp11->switch_reg &= 0xfffffffffffff000;
-        pidp11->switch_reg |=
-            ((~value & 0x00003ff0) >> 2) | ((~value & 0x0c000000) >> 26);
-        break;
-      case 1:
-        pidp11->switch_reg &= 0xffffffffffc00fff;
-        pidp11->switch_reg |=
-            ((~value & 0x00000ff0) << 10) | ((~value & 0x0c000000) >> 14);
-        pidp11->switch_addr = (value & (1 << 12)) == 0;
-        pidp11->switch_data = (value & (1 << 13)) == 0;
-        break;
-      case 2:
-        pidp11->switch_test = (value & (1 << 26)) != 0; // NOTE: inverted.
-        pidp11->switch_load_add = (value & (1 << 27)) == 0;
-        pidp11->switch_exam = (value & (1 << 4)) == 0;
-        pidp11->switch_dep = (value & (1 << 5)) == 0;
-        pidp11->switch_cont = (value & (1 << 6)) == 0;
-        pidp11->switch_ena_halt = (value & (1 << 7)) == 0;
-        pidp11->switch_sing_inst = (value & (1 << 8)) == 0;
-        pidp11->switch_start = (value & (1 << 9)) == 0;
-        pidp11->switch_addr_rot1 = (value & (1 << 10)) == 0;
-        pidp11->switch_addr_rot2 = (value & (1 << 11)) == 0;
-        pidp11->switch_data_rot1 = (value & (1 << 12)) == 0;
-        pidp11->switch_data_rot2 = (value & (1 << 13)) == 0;
-        break;
-#ifdef DEBUG
-      default:
-        printf("DANGER: There are only three rows.");
-#endif
+      if (row_usec) {
+        wait_until(row_start + slot_end[k], pidp11->spin_usec * 1000LL);
+      }
+    }
+    gpio_fast_set_bits(gpio, led_bit, 0);
+    if (pidp11->collect_stats) {
+      pidp11->frame_row_ns[i] = now_ns() - lit;
+      pidp11->frame_rows = i + 1;
+    }
+    if (row_usec) {
+      deadline = row_start + row_ns;
+      if (on_ns < row_ns) {
+        sleep_until(deadline);
       }
-      gpio_set_pins(gpio, row_pin, 1, 1);
     }
-    gpio_set_pull_pins(gpio, col_pins, n_col_pins, OFF);
+  }
+  // Capture switch state
+  int64_t switch_start = pidp11->collect_stats ? now_ns() : 0;
+  gpio_fast_set_pins(gpio, row_pins, n_row_pins, 1);
+  if (!pidp11->cols_pulled_up) {
+    gpio_fast_set_pull_pins(gpio, col_pins, n_col_pins, UP);
+    pidp11->cols_pulled_up = 1;
+  }
+  gpio_fast_set_function_pins(gpio, col_pins, n_col_pins, IN);
+  if (!pidp11->events_armed || events != 0 || pidp11->scan_countdown == 0) {
+    pidp11->scan_countdown = pidp11->scan_interval;
+    pidp11_scan_switches(pidp11, events);
+  } else {
+    pidp11->scan_countdown--;
+  }
+
+  if (pidp11->scan_flags & PIDP11_SCAN_EVENTS) {
+    pidp11_watch_switches(pidp11);
+  } else if (pidp11->events_armed) {
+    pidp11_disarm_events(pidp11);
+  }
+  if (!pidp11->events_armed &&
+      !(pidp11->scan_flags & PIDP11_SCAN_FIXED_PULLS)) {
+    gpio_fast_set_pull_pins(gpio, col_pins, n_col_pins, OFF);
+    pidp11->cols_pulled_up = 0;
+  }
+  if (pidp11->collect_stats) {
+    pidp11->frame_switch_ns = now_ns() - switch_start;
+  }
+}
+
+/**
+ * Touch the stack the refresh loop will use, so its pages are mapped, and
+ * locked with the rest of memory, before the loop starts.
+ */
+static void prefault_stack(void) {
+  volatile unsigned char stack[prefault_stack_size];
+  for (size_t i = 0; i < prefault_stack_size; i += 4096) {
+    stack[i] = 0;
+  }
+  (void)stack;
+}
+
+/**
+ * Apply the real-time settings to the calling thread. A setting that cannot
+ * be applied, usually for lack of privilege, is reported and skipped.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ */
+static void pidp11_realtime(pidp11_t *pidp11) {
+  if (pidp11->lock_memory) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+      fprintf(stderr, "PiDP11: mlockall: %s\n", strerror(errno));
+    }
+    prefault_stack();
+  }
+  if (pidp11->cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(pidp11->cpu, &cpus);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+    if (err) {
+      fprintf(stderr, "PiDP11: CPU %d: %s\n", pidp11->cpu, strerror(err));
+    }
+  }
+  if (pidp11->rt_priority > 0) {
+    struct sched_param param = {.sched_priority = pidp11->rt_priority};
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err) {
+      fprintf(stderr, "PiDP11: SCHED_FIFO priority %d: %s\n",
+              pidp11->rt_priority, strerror(err));
+    }
+  }
+}
+
+/**
+ * Choose the refresh rate for a frame from how long the panel has
+ * been idle: no lamp or switch changes, and no switch change waiting out its
+ * debounce time.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ * @param now the time, in nanoseconds.
+ * @return the frame period, in microseconds.
+ */
+static unsigned int pidp11_choose_rate(pidp11_t *pidp11, int64_t now) {
+  int64_t idle = now - pidp11->activity_ns;
+
+  if (pidp11->pending_switches != 0) {
+    idle = 0;
+  }
+  if (pidp11->blank_after_usec && idle >= pidp11->blank_after_usec * 1000LL) {
+    pidp11->rate = PIDP11_RATE_BLANK;
+    return blank_frame_usec;
+  }
+  if (pidp11->idle_after_usec && pidp11->idle_frame_usec &&
+      idle >= pidp11->idle_after_usec * 1000LL) {
+    pidp11->rate = PIDP11_RATE_IDLE;
+    return pidp11->idle_frame_usec;
+  }
+  pidp11->rate = PIDP11_RATE_FULL;
+  return pidp11->frame_usec;
+}
+
+/**
+ * Fold a frame into the refresh loop statistics, under the statistics
+ * sequence lock.
+ *
+ * @param pidp11 the PiDP11 data structure.
+ * @param rate the frame's refresh rate.
+ * @param period the frame's period, in nanoseconds.
+ * @param error the difference from the rate's period, in nanoseconds.
+ * @param cpu the thread CPU time the frame took, in nanoseconds.
+ * @param overrun whether the frame overran.
+ */
+static void pidp11_record_frame(pidp11_t *pidp11, pidp11_rate_t rate,
+                                int64_t period, int64_t error, int64_t cpu,
+                                int overrun) {
+  pidp11_stats_t *stats = &pidp11->stats;
+  unsigned int seq =
+      atomic_load_explicit(&pidp11->stats_seq, memory_order_relaxed);
+  atomic_store_explicit(&pidp11->stats_seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  stats->frames++;
+  stats->overruns += overrun;
+  stats->missed_deadlines += pidp11->frame_missed;
+  stats->period_total_ns += period;
+  stats->total_error_ns += error;
+  if (error > stats->max_error_ns) {
+    stats->max_error_ns = error;
+  }
+  int64_t bucket = error / 1000;
+  stats->jitter_histogram[bucket < PIDP11_JITTER_BUCKETS
+                              ? bucket
+                              : PIDP11_JITTER_BUCKETS - 1]++;
+  for (int i = 0; i < pidp11->frame_rows; i++) {
+    stats->row_count[i]++;
+    stats->row_total_ns[i] += pidp11->frame_row_ns[i];
+    if (pidp11->frame_row_ns[i] > stats->row_max_ns[i]) {
+      stats->row_max_ns[i] = pidp11->frame_row_ns[i];
+    }
+  }
+  stats->switch_count++;
+  stats->switch_total_ns += pidp11->frame_switch_ns;
+  if (pidp11->frame_switch_ns > stats->switch_max_ns) {
+    stats->switch_max_ns = pidp11->frame_switch_ns;
+  }
+  stats->rate_frames[rate]++;
+  stats->rate_wall_ns[rate] += period;
+  stats->rate_cpu_ns[rate] += cpu;
+
+  atomic_store_explicit(&pidp11->stats_seq, seq + 2, memory_order_release);
+  pidp11->frame_missed = 0;
+}
+
+static int64_t thread_cpu_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void *pidp11_update(void *context) {
+  pidp11_t *pidp11 = (pidp11_t *)context;
+
+  pidp11_realtime(pidp11);
+  pthread_cleanup_push(pidp11_cleanup, pidp11);
+  int64_t start = now_ns();
+  int64_t cpu_start = thread_cpu_ns();
+  int64_t next = start;
+  while (1) {
+    unsigned int period_usec = pidp11->frame_usec;
+    if (period_usec) {
+      period_usec = pidp11_choose_rate(pidp11, start);
+    }
+    pidp11_rate_t rate = pidp11->rate;
+    pidp11_refresh(pidp11);
 
     // Do stuff with the switch values.
     // if switch_dep set_mem(addr, data), etc.
 
+    if (period_usec) {
+      // Start frames on a fixed schedule. A frame that overruns its period
+      // starts the next one at once, and the schedule restarts from there.
+      next += period_usec * 1000LL;
+      int64_t now = now_ns();
+      int overrun = now > next;
+      if (overrun) {
+        next = now;
+      } else {
+        sleep_until(next);
+      }
+
+      int64_t end = now_ns();
+      int64_t cpu_end = thread_cpu_ns();
+      int64_t error = end - start - period_usec * 1000LL;
+      if (error < 0) {
+        error = -error;
+      }
+      pidp11_record_frame(pidp11, rate, end - start, error,
+                          cpu_end - cpu_start, overrun);
+      start = end;
+      cpu_start = cpu_end;
+    }
     pthread_testcancel();
   }
   pthread_cleanup_pop(1);
   return NULL;
 }
 
-int pidp11_init(pidp11_t *pidp11, gpio_t *gpio) {
+int pidp11_configure(pidp11_t *pidp11, gpio_t *gpio) {
   pidp11->gpio = gpio;
+  if (matrix_compile(&matrix, &pidp11_layout)) {
+    return -1;
+  }
+  uint64_t col_bits = matrix.col_bits;
+  pidp11->lamps_compiled = 0;
 
-  gpio_set_function_pins(gpio, led_pins, n_led_pins, OUT);
-  gpio_set_function_pins(gpio, col_pins, n_col_pins, OUT);
-  gpio_set_function_pins(gpio, row_pins, n_row_pins, OUT);
+  uint64_t led_bits = pins_to_bits(led_pins, n_led_pins);
+  uint64_t row_bits = pins_to_bits(row_pins, n_row_pins);
 
-  gpio_set_pins(gpio, led_pins, n_led_pins, 0);
-  gpio_set_pins(gpio, col_pins, n_col_pins, 1);
-  gpio_set_pins(gpio, row_pins, n_row_pins, 1);
+  // Set the output values first, so the pins come up idle. The LED and
+  // switch rows are set together, so a backend that groups its pins, such
+  // as gpiochip, drives them as one group, and the columns as another.
+  gpio_set_bits(gpio, led_bits, 0);
+  gpio_set_bits(gpio, col_bits, 1);
+  gpio_set_bits(gpio, row_bits, 1);
+  gpio_set_function_bits(gpio, led_bits | row_bits, OUT);
+  gpio_set_function_bits(gpio, col_bits, OUT);
 
+  // The column pull-ups are for the switch scan. They stay on from here in
+  // the fixed-pulls and events scan modes.
+  gpio_set_pull_bits(gpio, col_bits, UP);
+  pidp11->cols_pulled_up = 1;
+
+  pthread_mutex_init(&pidp11->lamp_lock, NULL);
+  pidp11_lock_lamps(pidp11);
   pidp11->data_mode = DATA_PATHS;
-  pidp11->addr_mode = ADDR_CONS_PHY;
+  pidp11->addr_mode = ADDR_PROG_PHY;
+  memset(&pidp11->addr_knob, 0, sizeof pidp11->addr_knob);
+  memset(&pidp11->data_knob, 0, sizeof pidp11->data_knob);
+  pidp11_unlock_lamps(pidp11);
 
-  pthread_create(&pidp11->update_thread, NULL, pidp11_update, pidp11);
+  pidp11->row_usec = (100000 / 60) / 6;
+  pidp11->settle_usec = 10;
+  // Six LED rows, plus the switch scan with the pull changes it takes on the
+  // BCM2835: about the period the refresh loop had when it ran free.
+  pidp11->frame_usec = 2200;
+  pidp11->brightness = 100;
+  pidp11->bcm_bits = 0;
+  pidp11->spin_usec = 0;
+  pidp11->debounce_usec = 5000;
+  pidp11->idle_after_usec = 1000000;
+  pidp11->idle_frame_usec = 10000;
+  pidp11->blank_after_usec = 0;
+  pidp11->rate = PIDP11_RATE_FULL;
+  pidp11->activity_ns = now_ns();
+  pidp11->scan_interval = 8;
+  pidp11->rt_priority = 0;
+  pidp11->cpu = -1;
+  pidp11->lock_memory = 0;
+  pidp11->event_fd = -1;
   return 0;
 }
 
+int pidp11_start(pidp11_t *pidp11) {
+  pidp11->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (pidp11->event_fd < 0) {
+    return -1;
+  }
+  pidp11->collect_stats = 1;
+  return pthread_create(&pidp11->update_thread, NULL, pidp11_update, pidp11);
+}
+
+int pidp11_init(pidp11_t *pidp11, gpio_t *gpio) {
+  pidp11_configure(pidp11, gpio);
+  return pidp11_start(pidp11);
+}
+
+/**
+ * Read an integer setting from the environment.
+ *
+ * @param name the environment variable.
+ * @param value the setting, left unchanged if the variable is not set.
+ */
+static void getenv_int(const char *name, int *value) {
+  const char *s = getenv(name);
+  if (s != NULL && *s != '\0') {
+    *value = atoi(s);
+  }
+}
+
+void pidp11_load_env(pidp11_t *pidp11) {
+  int row_usec = pidp11->row_usec;
+  int frame_usec = pidp11->frame_usec;
+  int debounce_usec = pidp11->debounce_usec;
+  int idle_after_usec = pidp11->idle_after_usec;
+  int idle_frame_usec = pidp11->idle_frame_usec;
+  int blank_after_usec = pidp11->blank_after_usec;
+  int lock_memory = pidp11->lock_memory;
+  int brightness = pidp11->brightness;
+  int bcm_bits = pidp11->bcm_bits;
+  int spin_usec = pidp11->spin_usec;
+
+  pidp11->scan_flags = pidp11_parse_scan_flags(getenv("PIDP11_SCAN"));
+  getenv_int("PIDP11_ROW_USEC", &row_usec);
+  getenv_int("PIDP11_FRAME_USEC", &frame_usec);
+  getenv_int("PIDP11_DEBOUNCE_USEC", &debounce_usec);
+  getenv_int("PIDP11_IDLE_USEC", &idle_after_usec);
+  getenv_int("PIDP11_IDLE_FRAME_USEC", &idle_frame_usec);
+  getenv_int("PIDP11_BLANK_USEC", &blank_after_usec);
+  getenv_int("PIDP11_RT_PRIORITY", &pidp11->rt_priority);
+  getenv_int("PIDP11_CPU", &pidp11->cpu);
+  getenv_int("PIDP11_MLOCK", &lock_memory);
+  getenv_int("PIDP11_BRIGHTNESS", &brightness);
+  getenv_int("PIDP11_BCM_BITS", &bcm_bits);
+  getenv_int("PIDP11_SPIN_USEC", &spin_usec);
+  pidp11->row_usec = row_usec < 0 ? 0 : row_usec;
+  pidp11->frame_usec = frame_usec < 0 ? 0 : frame_usec;
+  pidp11->debounce_usec = debounce_usec < 0 ? 0 : debounce_usec;
+  pidp11->idle_after_usec = idle_after_usec < 0 ? 0 : idle_after_usec;
+  pidp11->idle_frame_usec = idle_frame_usec < 0 ? 0 : idle_frame_usec;
+  pidp11->blank_after_usec = blank_after_usec < 0 ? 0 : blank_after_usec;
+  pidp11->lock_memory = lock_memory != 0;
+  pidp11->brightness = brightness < 0 ? 0 : brightness > 100 ? 100 : brightness;
+  pidp11->bcm_bits = bcm_bits < 0                     ? 0
+                     : bcm_bits > PIDP11_MAX_BCM_BITS ? PIDP11_MAX_BCM_BITS
+                                                      : bcm_bits;
+  pidp11->spin_usec = spin_usec < 0 ? 0 : spin_usec;
+  pidp11->lamps_compiled = 0;
+}
+
+void pidp11_lock_lamps(pidp11_t *pidp11) {
+  pthread_mutex_lock(&pidp11->lamp_lock);
+}
+
+void pidp11_unlock_lamps(pidp11_t *pidp11) {
+  pidp11_lamp_state_t state;
+
+  // Clear the padding, so it is not copied uninitialized.
+  memset(&state, 0, sizeof state);
+  state.address = pidp11->address;
+  state.data = pidp11->data;
+  state.addr_mode = pidp11->addr_mode;
+  state.data_mode = pidp11->data_mode;
+  state.addressing_length = pidp11->addressing_length;
+  state.parity_high = pidp11->parity_high;
+  state.parity_low = pidp11->parity_low;
+  state.parity_err = pidp11->parity_err;
+  state.address_err = pidp11->address_err;
+  state.run_state = pidp11->run_state;
+  state.run_level = pidp11->run_level;
+  state.data_ref = pidp11->data_ref;
+  state.glowing = pidp11->glowing;
+  memcpy(state.glow, pidp11->glow, sizeof state.glow);
+
+  unsigned int seq =
+      atomic_load_explicit(&pidp11->lamp_seq, memory_order_relaxed);
+  atomic_store_explicit(&pidp11->lamp_seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  memcpy(&pidp11->lamps, &state, sizeof state);
+  atomic_store_explicit(&pidp11->lamp_seq, seq + 2, memory_order_release);
+  pthread_mutex_unlock(&pidp11->lamp_lock);
+}
+
+/**
+ * Follow a rotary encoder to the given switches.
+ *
+ * @param knob the encoder.
+ * @param switches the PIDP11_SWITCH_* bits.
+ * @param rot1 the switch bit of the encoder's first phase.
+ * @param rot2 the switch bit of the encoder's second phase.
+ * @return the detents turned: 1 clockwise, -1 anticlockwise, or 0.
+ */
+static int pidp11_turn_knob(pidp11_knob_t *knob, uint64_t switches,
+                            uint64_t rot1, uint64_t rot2) {
+  // The position of each phase in the Gray code sequence 00, 01, 11, 10.
+  static const int position[] = {0, 1, 3, 2};
+  uint8_t phase = ((switches & rot1) != 0) | ((switches & rot2) != 0) << 1;
+
+  if (!knob->started) {
+    knob->started = 1;
+    knob->phase = phase;
+    knob->rest = phase;
+    knob->steps = 0;
+    return 0;
+  }
+  if (phase == knob->phase) {
+    return 0;
+  }
+  int step = (position[phase] - position[knob->phase]) & 3;
+  if (step == 1) {
+    knob->steps++;
+  } else if (step == 3) {
+    knob->steps--;
+  }
+  knob->phase = phase;
+  if (phase != knob->rest) {
+    return 0;
+  }
+  // Back at rest: a missed phase leaves the count short of four.
+  int detents = knob->steps >= 2 ? 1 : knob->steps <= -2 ? -1 : 0;
+  knob->steps = 0;
+  return detents;
+}
+
+int pidp11_turn_selectors(pidp11_t *pidp11, uint64_t switches) {
+  int addr = pidp11_turn_knob(&pidp11->addr_knob, switches,
+                              PIDP11_SWITCH_ADDR_ROT1, PIDP11_SWITCH_ADDR_ROT2);
+  int data = pidp11_turn_knob(&pidp11->data_knob, switches,
+                              PIDP11_SWITCH_DATA_ROT1, PIDP11_SWITCH_DATA_ROT2);
+  if (addr == 0 && data == 0) {
+    return 0;
+  }
+  pidp11_lock_lamps(pidp11);
+  pidp11->addr_mode = (pidp11->addr_mode + n_addr_modes + addr) % n_addr_modes;
+  pidp11->data_mode = (pidp11->data_mode + n_data_modes + data) % n_data_modes;
+  pidp11_unlock_lamps(pidp11);
+  return 1;
+}
+
+uint64_t pidp11_get_switches(pidp11_t *pidp11, uint64_t *changed) {
+  if (changed != NULL) {
+    *changed = atomic_exchange_explicit(&pidp11->switch_changes, 0,
+                                        memory_order_acquire);
+  }
+  return atomic_load_explicit(&pidp11->switches, memory_order_acquire);
+}
+
+int pidp11_read_event(pidp11_t *pidp11, pidp11_event_t *event) {
+  unsigned int tail =
+      atomic_load_explicit(&pidp11->event_tail, memory_order_relaxed);
+  unsigned int head =
+      atomic_load_explicit(&pidp11->event_head, memory_order_acquire);
+
+  if (tail == head) {
+    return 0;
+  }
+  *event = pidp11->events[tail % PIDP11_EVENT_QUEUE_SIZE];
+  atomic_store_explicit(&pidp11->event_tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+int64_t pidp11_get_switch_time(pidp11_t *pidp11, uint64_t bit) {
+  int i = bit == 0 ? PIDP11_N_SWITCHES : __builtin_ctzll(bit);
+  if (i >= PIDP11_N_SWITCHES) {
+    return 0;
+  }
+  return atomic_load_explicit(&pidp11->switch_time_ns[i],
+                              memory_order_relaxed);
+}
+
+unsigned int pidp11_parse_scan_flags(const char *names) {
+  const struct {
+    const char *name;
+    unsigned int flag;
+  } flag_names[] = {{"events", PIDP11_SCAN_EVENTS},
+                    {"fixed-pulls", PIDP11_SCAN_FIXED_PULLS}};
+  unsigned int flags = 0;
+
+  while (names != NULL && *names != '\0') {
+    size_t len = strcspn(names, ",");
+    for (int i = 0; i < sizeof flag_names / sizeof flag_names[0]; i++) {
+      if (len == strlen(flag_names[i].name) &&
+          strncmp(names, flag_names[i].name, len) == 0) {
+        flags |= flag_names[i].flag;
+      }
+    }
+    names += len;
+    if (*names == ',') {
+      names++;
+    }
+  }
+  return flags;
+}
+
+void pidp11_get_stats(pidp11_t *pidp11, pidp11_stats_t *stats) {
+  unsigned int seq;
+  do {
+    seq = atomic_load_explicit(&pidp11->stats_seq, memory_order_acquire);
+    memcpy(stats, &pidp11->stats, sizeof *stats);
+    atomic_thread_fence(memory_order_acquire);
+  } while ((seq & 1) ||
+           seq != atomic_load_explicit(&pidp11->stats_seq,
+                                       memory_order_relaxed));
+}
+
+int64_t pidp11_stats_jitter_percentile(const pidp11_stats_t *stats,
+                                       double q) {
+  uint64_t count = 0;
+  uint64_t target = q * stats->frames;
+
+  for (int i = 0; i < PIDP11_JITTER_BUCKETS - 1; i++) {
+    count += stats->jitter_histogram[i];
+    if (count > target) {
+      return (i + 1) * 1000LL;
+    }
+  }
+  return stats->max_error_ns;
+}
+
+void pidp11_print_timing(pidp11_t *pidp11, FILE *out) {
+  const char *rate_names[] = {"full", "idle", "blank"};
+  pidp11_stats_t stats;
+
+  pidp11_get_stats(pidp11, &stats);
+  if (stats.frames == 0) {
+    return;
+  }
+  fprintf(out,
+          "PiDP11: %llu frames, period error mean %.1f us, p99 %.1f us, "
+          "max %.1f us, %llu overruns, %llu missed row deadlines\n",
+          (unsigned long long)stats.frames,
+          (double)stats.total_error_ns / stats.frames / 1000,
+          (double)pidp11_stats_jitter_percentile(&stats, 0.99) / 1000,
+          (double)stats.max_error_ns / 1000,
+          (unsigned long long)stats.overruns,
+          (unsigned long long)stats.missed_deadlines);
+  for (int i = 0; i < PIDP11_N_RATES; i++) {
+    if (stats.rate_frames[i] == 0) {
+      continue;
+    }
+    fprintf(out, "PiDP11: %s rate: %llu frames, %.1f s, %.2f%% CPU\n",
+            rate_names[i], (unsigned long long)stats.rate_frames[i],
+            (double)stats.rate_wall_ns[i] / 1000000000,
+            100.0 * stats.rate_cpu_ns[i] / stats.rate_wall_ns[i]);
+  }
+}
+
 int pidp11_close(pidp11_t *pidp11) {
   pthread_cancel(pidp11->update_thread);
   void *retval;
   pthread_join(pidp11->update_thread, &retval);
+  pthread_mutex_destroy(&pidp11->lamp_lock);
+  if (pidp11->event_fd >= 0) {
+    close(pidp11->event_fd);
+    pidp11->event_fd = -1;
+  }
   return 0;
 }
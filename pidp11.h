@@ -21,8 +21,11 @@
  */
 
 #ifndef PIDP11_H
+#define PIDP11_H
 
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
 
 #include "gpio.h"
 
@@ -62,11 +65,235 @@ typedef enum _run_level_t {
   RUN_LEVEL_KERNEL
 } run_level_t;
 
+/*
+ * Switch scanning flags.
+ *
+ * PIDP11_SCAN_EVENTS: between frames, hold the momentary switch row low with
+ * the columns as pulled-up inputs, and latch column edges with the GPIO event
+ * detector. A frame rescans the switches only when an edge was latched, or
+ * every scan_interval frames to pick up the toggle switches; other frames
+ * skip the row scan and decoding. A momentary switch pressed and released
+ * between two scans reads as pressed for one frame. Falls back to scanning
+ * every frame if the GPIO device has no event detection.
+ *
+ * PIDP11_SCAN_FIXED_PULLS: leave the column pull-ups on, instead of turning
+ * them on for the switch scan and off for the lamps. The lamp phase drives
+ * every column explicitly, high or low, so the pull-ups do not affect it, and
+ * the refresh loop does not touch the pull registers after the first frame.
+ */
+static const unsigned int PIDP11_SCAN_EVENTS = 1 << 0;
+static const unsigned int PIDP11_SCAN_FIXED_PULLS = 1 << 1;
+
+/*
+ * The switches, as published by the display update thread: the switch
+ * register in the low 22 bits, and a bit for each of the other switches,
+ * set while it is on or pressed.
+ */
+#define PIDP11_N_SWITCHES 36
+
+static const uint64_t PIDP11_SWITCH_REG = 0x3fffff;
+static const uint64_t PIDP11_SWITCH_TEST = (uint64_t)1 << 22;
+static const uint64_t PIDP11_SWITCH_LOAD_ADD = (uint64_t)1 << 23;
+static const uint64_t PIDP11_SWITCH_EXAM = (uint64_t)1 << 24;
+static const uint64_t PIDP11_SWITCH_DEP = (uint64_t)1 << 25;
+static const uint64_t PIDP11_SWITCH_CONT = (uint64_t)1 << 26;
+static const uint64_t PIDP11_SWITCH_ENA_HALT = (uint64_t)1 << 27;
+static const uint64_t PIDP11_SWITCH_SING_INST = (uint64_t)1 << 28;
+static const uint64_t PIDP11_SWITCH_START = (uint64_t)1 << 29;
+static const uint64_t PIDP11_SWITCH_ADDR = (uint64_t)1 << 30;
+static const uint64_t PIDP11_SWITCH_ADDR_ROT1 = (uint64_t)1 << 31;
+static const uint64_t PIDP11_SWITCH_ADDR_ROT2 = (uint64_t)1 << 32;
+static const uint64_t PIDP11_SWITCH_DATA = (uint64_t)1 << 33;
+static const uint64_t PIDP11_SWITCH_DATA_ROT1 = (uint64_t)1 << 34;
+static const uint64_t PIDP11_SWITCH_DATA_ROT2 = (uint64_t)1 << 35;
+
+/**
+ * A rotary selector's encoder: its phase, as ROT1 in bit 0 and ROT2 in bit
+ * 1, the phase it rests in between detents, and the quarter steps it has
+ * turned since it last rested, positive for clockwise.
+ */
+typedef struct _pidp11_knob_t {
+  char started;
+  uint8_t phase;
+  uint8_t rest;
+  int8_t steps;
+} pidp11_knob_t;
+
+/**
+ * The lamps that can glow: A0 to A21, then D0 to D15. Each has an intensity
+ * from zero, dark, to PIDP11_GLOW_MAX, fully lit.
+ */
+#define PIDP11_GLOW_LAMPS 38
+static const int PIDP11_GLOW_MAX = 255;
+
+/**
+ * A snapshot of the lamp fields of pidp11_t, as published to the display
+ * update thread.
+ */
+typedef struct _pidp11_lamp_state_t {
+  uint32_t address;
+  uint16_t data;
+  addr_mode_t addr_mode;
+  data_mode_t data_mode;
+  addressing_length_t addressing_length;
+  char parity_high;
+  char parity_low;
+  char parity_err;
+  char address_err;
+  run_state_t run_state;
+  run_level_t run_level;
+  char data_ref;
+  char glowing;
+  uint8_t glow[PIDP11_GLOW_LAMPS];
+} pidp11_lamp_state_t;
+
+/**
+ * A switch event: the switches after an accepted change, the switches that
+ * changed, and when the change was first seen, in CLOCK_MONOTONIC
+ * nanoseconds.
+ */
+typedef struct _pidp11_event_t {
+  uint64_t switches;
+  uint64_t changed;
+  int64_t time_ns;
+} pidp11_event_t;
+
+#define PIDP11_EVENT_QUEUE_SIZE 64
+
+// The most bits of binary code modulation per lamp.
+#define PIDP11_MAX_BCM_BITS 6
+
+/**
+ * Refresh rates: the full rate while the panel is active, the idle rate
+ * once nothing has changed for a while, and blanked lamps with a slow
+ * switch scan once nothing has changed for longer.
+ */
+typedef enum _pidp11_rate_t {
+  PIDP11_RATE_FULL,
+  PIDP11_RATE_IDLE,
+  PIDP11_RATE_BLANK,
+  PIDP11_N_RATES
+} pidp11_rate_t;
+
+#define PIDP11_JITTER_BUCKETS 1024
+
+/**
+ * Refresh loop statistics, kept by the display update thread. Times are in
+ * nanoseconds. The jitter is the difference between a frame's period and
+ * the period of its refresh rate. Its histogram has 1 us buckets, and the
+ * last bucket also counts everything longer. A missed deadline is an LED row
+ * that was lit after it was due to go dark; an overrun is a frame that ended
+ * after the next was due to start.
+ */
+typedef struct _pidp11_stats_t {
+  uint64_t frames;
+  uint64_t overruns;
+  uint64_t missed_deadlines;
+  uint64_t period_total_ns;
+  int64_t max_error_ns;
+  uint64_t total_error_ns;
+  uint64_t jitter_histogram[PIDP11_JITTER_BUCKETS];
+
+  // The time each LED row was lit, and the switch phase of each frame.
+  uint64_t row_count[6];
+  uint64_t row_total_ns[6];
+  int64_t row_max_ns[6];
+  uint64_t switch_count;
+  uint64_t switch_total_ns;
+  int64_t switch_max_ns;
+
+  // The frames, time and thread CPU time at each refresh rate.
+  uint64_t rate_frames[PIDP11_N_RATES];
+  uint64_t rate_wall_ns[PIDP11_N_RATES];
+  uint64_t rate_cpu_ns[PIDP11_N_RATES];
+} pidp11_stats_t;
+
 typedef struct _pidp11_t {
   gpio_t *gpio;
   pthread_t update_thread;
 
-  // The lamps
+  // Refresh timing, in microseconds. Zero skips the sleep. The display
+  // update thread starts a frame every frame_usec, or as soon as the last
+  // one ends if frame_usec is zero.
+  unsigned int row_usec;
+  unsigned int settle_usec;
+  unsigned int frame_usec;
+
+  // Lamp brightness: the percentage of each LED row's time it is lit, and
+  // the bits of binary code modulation, or zero for lamps that are on or
+  // off. With bcm_bits set, the lit time is split into slots weighted 1, 2,
+  // 4 and so on, and each lamp is lit in the slots that sum to its
+  // intensity. Slots shorter than spin_usec are busy-waited rather than
+  // slept, for accuracy at the cost of CPU time.
+  unsigned int brightness;
+  unsigned int bcm_bits;
+  unsigned int spin_usec;
+
+  // How long a switch must read the same before a change is accepted, in
+  // microseconds. Zero accepts every change at once.
+  unsigned int debounce_usec;
+
+  // Adaptive refresh rate, in microseconds: after idle_after_usec with no
+  // lamp or switch changes, frames start every idle_frame_usec; after
+  // blank_after_usec, the lamps are blanked until something changes. Zero
+  // disables either step. These only apply when frame_usec is set.
+  unsigned int idle_after_usec;
+  unsigned int idle_frame_usec;
+  unsigned int blank_after_usec;
+  pidp11_rate_t rate;
+  int64_t activity_ns;
+
+  // Display update thread settings: the SCHED_FIFO priority, or zero for the
+  // default scheduler; the CPU to run on, or -1 for any; and whether to lock
+  // memory and pre-fault the stack.
+  int rt_priority;
+  int cpu;
+  char lock_memory;
+
+  // Refresh loop statistics, kept by the display update thread when
+  // frame_usec is set, and published under a sequence lock like the lamps;
+  // and the phase times of the frame being refreshed.
+  char collect_stats;
+  atomic_uint stats_seq;
+  pidp11_stats_t stats;
+  int frame_rows;
+  int64_t frame_row_ns[6];
+  int64_t frame_switch_ns;
+  uint64_t frame_missed;
+
+  // Switch scanning, PIDP11_SCAN_* flags.
+  unsigned int scan_flags;
+  unsigned int scan_interval;
+
+  // Switch scanning state.
+  char events_armed;
+  char cols_pulled_up;
+  unsigned int scan_countdown;
+  uint64_t watch_levels;
+
+  // The published lamps: a snapshot of the lamp fields, under a sequence
+  // lock. The sequence is odd while the snapshot is being written. Writers
+  // serialize on lamp_lock; the display update thread never takes it.
+  pthread_mutex_t lamp_lock;
+  atomic_uint lamp_seq;
+  pidp11_lamp_state_t lamps;
+
+  // Compiled lamps: the snapshot sequence and lamp test switch they were
+  // compiled from, the snapshot's lamps and glow intensities, the glow
+  // dithering error, and for each LED row and modulation slot, the column
+  // pins to set and clear to light its lamps.
+  char lamps_compiled;
+  unsigned int compiled_seq;
+  char compiled_test;
+  uint64_t compiled_lamps;
+  char compiled_glowing;
+  uint8_t compiled_glow[PIDP11_GLOW_LAMPS];
+  uint16_t glow_error[PIDP11_GLOW_LAMPS];
+  uint64_t row_set_bits[6][PIDP11_MAX_BCM_BITS];
+  uint64_t row_clear_bits[6][PIDP11_MAX_BCM_BITS];
+
+  // The lamps. Change them between pidp11_lock_lamps() and
+  // pidp11_unlock_lamps().
   uint32_t address;
   uint16_t data;
   addr_mode_t addr_mode;
@@ -81,22 +308,39 @@ typedef struct _pidp11_t {
   run_level_t run_level;
   char data_ref;
 
-  // The switches
-  uint32_t switch_reg;
-  char switch_test;
-  char switch_load_add;
-  char switch_exam;
-  char switch_dep;
-  char switch_cont;
-  char switch_ena_halt;
-  char switch_sing_inst;
-  char switch_start;
-  char switch_addr;
-  char switch_addr_rot1;
-  char switch_addr_rot2;
-  char switch_data;
-  char switch_data_rot1;
-  char switch_data_rot2;
+  // The ADDRESS and DATA selectors behind addr_mode and data_mode, private
+  // to the thread that calls pidp11_turn_selectors().
+  pidp11_knob_t addr_knob;
+  pidp11_knob_t data_knob;
+
+  // While glowing is set, the address and data lamps show their glow
+  // intensities instead of address and data: modulated if bcm_bits is set,
+  // otherwise dithered over the frames.
+  char glowing;
+  uint8_t glow[PIDP11_GLOW_LAMPS];
+
+  // The switches, PIDP11_SWITCH_* bits: as last scanned, and as debounced,
+  // with the changes waiting out the debounce time and when each was first
+  // seen, private to the display update thread; as published after each
+  // scan; and the bits that changed since pidp11_get_switches() last took
+  // them. Each switch's time is when its last accepted change was first
+  // seen, on the CLOCK_MONOTONIC clock.
+  uint64_t scanned_switches;
+  uint64_t debounced_switches;
+  uint64_t pending_switches;
+  int64_t pending_since[PIDP11_N_SWITCHES];
+  _Atomic uint64_t switches;
+  _Atomic uint64_t switch_changes;
+  _Atomic int64_t switch_time_ns[PIDP11_N_SWITCHES];
+
+  // The switch event queue, a single producer, single consumer ring written
+  // by the display update thread, and an eventfd it signals, or -1. Events
+  // that find the queue full are counted and dropped.
+  int event_fd;
+  pidp11_event_t events[PIDP11_EVENT_QUEUE_SIZE];
+  atomic_uint event_head;
+  atomic_uint event_tail;
+  atomic_uint events_dropped;
 } pidp11_t;
 
 /**
@@ -108,6 +352,155 @@ typedef struct _pidp11_t {
  */
 int pidp11_init(pidp11_t *pidp11, gpio_t *gpio);
 
+/**
+ * Configure the PiDP11 pins and defaults, without starting the display
+ * update thread. pidp11_init() calls this; callers that change the settings
+ * before the thread starts, or drive pidp11_refresh() themselves, such as the
+ * benchmark, call it directly.
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ * @param[in] gpio The GPIO connected to PiDP11
+ * @return zero on success.
+ */
+int pidp11_configure(pidp11_t *pidp11, gpio_t *gpio);
+
+/**
+ * Start the display update thread on a configured PiDP11, and create the
+ * switch event fd.
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ * @return zero on success.
+ */
+int pidp11_start(pidp11_t *pidp11);
+
+/**
+ * Override the configured settings from the environment:
+ *
+ *   PIDP11_SCAN         switch scanning flags, see pidp11_parse_scan_flags()
+ *   PIDP11_ROW_USEC     time each LED row is lit
+ *   PIDP11_FRAME_USEC   frame period, or 0 to run frames back to back
+ *   PIDP11_DEBOUNCE_USEC  time a switch change must hold to be accepted
+ *   PIDP11_IDLE_USEC    idle time before dropping to the idle rate, or 0
+ *   PIDP11_IDLE_FRAME_USEC  frame period at the idle rate
+ *   PIDP11_BLANK_USEC   idle time before blanking the lamps, or 0
+ *   PIDP11_RT_PRIORITY  SCHED_FIFO priority of the display update thread
+ *   PIDP11_CPU          CPU to run the display update thread on
+ *   PIDP11_MLOCK        1 to lock memory and pre-fault the thread's stack
+ *   PIDP11_BRIGHTNESS   percentage of each LED row's time it is lit
+ *   PIDP11_BCM_BITS     bits of binary code modulation per lamp, or 0
+ *   PIDP11_SPIN_USEC    busy-wait modulation slots shorter than this
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ */
+void pidp11_load_env(pidp11_t *pidp11);
+
+/**
+ * Run one refresh cycle: light each LED row for row_usec, then scan the
+ * switch rows. The display update thread calls this continuously.
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ */
+void pidp11_refresh(pidp11_t *pidp11);
+
+/**
+ * Take the lamp lock, to change the lamp fields.
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ */
+void pidp11_lock_lamps(pidp11_t *pidp11);
+
+/**
+ * Publish the lamp fields to the display update thread, and release the lamp
+ * lock.
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ */
+void pidp11_unlock_lamps(pidp11_t *pidp11);
+
+/**
+ * Get the switches, and take the switches that changed since the last call.
+ * A change mask bit with no change in the switch bit means the switch went
+ * both ways in between, such as a momentary switch pressed and released.
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ * @param[out] changed The PIDP11_SWITCH_* bits that changed, or NULL.
+ * @return the PIDP11_SWITCH_* bits.
+ */
+uint64_t pidp11_get_switches(pidp11_t *pidp11, uint64_t *changed);
+
+/**
+ * Turn the ADDRESS and DATA selectors by the detents their rotary encoders
+ * moved to reach the given switches, and change addr_mode and data_mode to
+ * match. The selectors wrap around. Call it with each switch event, so no
+ * encoder phase is missed; phases that skip a step are ignored.
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ * @param[in] switches The PIDP11_SWITCH_* bits.
+ * @return 1 if either mode changed, 0 if not.
+ */
+int pidp11_turn_selectors(pidp11_t *pidp11, uint64_t switches);
+
+/**
+ * Take the next switch event from the queue. The event fd is readable while
+ * there may be events; read it to clear it, then take events until there
+ * are none left.
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ * @param[out] event The event.
+ * @return 1 if an event was taken, 0 if the queue is empty.
+ */
+int pidp11_read_event(pidp11_t *pidp11, pidp11_event_t *event);
+
+/**
+ * Get the time of a switch's last accepted change. Read it after
+ * pidp11_get_switches() reports the change.
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ * @param[in] bit One PIDP11_SWITCH_* bit, or one bit of PIDP11_SWITCH_REG.
+ * @return when the change was first seen, in CLOCK_MONOTONIC nanoseconds, or
+ *         zero if the switch has not changed.
+ */
+int64_t pidp11_get_switch_time(pidp11_t *pidp11, uint64_t bit);
+
+/**
+ * Parse a comma separated list of switch scanning flag names, such as the
+ * value of the PIDP11_SCAN environment variable. The names are "events" and
+ * "fixed-pulls".
+ *
+ * @param[in] names The flag names, or NULL for none.
+ * @return the PIDP11_SCAN_* flags. Unknown names are ignored.
+ */
+unsigned int pidp11_parse_scan_flags(const char *names);
+
+/**
+ * Get a consistent snapshot of the refresh loop statistics. Never blocks the
+ * display update thread.
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ * @param[out] stats The statistics.
+ */
+void pidp11_get_stats(pidp11_t *pidp11, pidp11_stats_t *stats);
+
+/**
+ * Estimate a frame jitter percentile from the jitter histogram.
+ *
+ * @param[in] stats The statistics.
+ * @param[in] q The percentile, from 0 to 1.
+ * @return the jitter, in nanoseconds: the upper edge of the bucket the
+ *         percentile falls in, or the maximum for the last bucket.
+ */
+int64_t pidp11_stats_jitter_percentile(const pidp11_stats_t *stats, double q);
+
+/**
+ * Print the frame timing of the display update thread: the frame count, the
+ * mean and maximum frame period error, the overruns, and the frames, time
+ * and CPU use at each refresh rate. Prints nothing if no frames were timed.
+ *
+ * @param[in] pidp11 The PiDP11 data structure
+ * @param[in] out The stream to print to
+ */
+void pidp11_print_timing(pidp11_t *pidp11, FILE *out);
+
 /**
  * Close PiDP11. Cancells the display update thread.
  *
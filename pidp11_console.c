@@ -0,0 +1,815 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pidp11_console.h"
+
+// Telnet commands and options, RFC 854 and RFC 856-858.
+#define TELNET_IAC 255
+#define TELNET_DONT 254
+#define TELNET_DO 253
+#define TELNET_WONT 252
+#define TELNET_WILL 251
+#define TELNET_SB 250
+#define TELNET_SE 240
+#define TELNET_BINARY 0
+#define TELNET_ECHO 1
+#define TELNET_SGA 3
+
+enum { TELNET_DATA, TELNET_COMMAND, TELNET_OPTION, TELNET_SUB, TELNET_SUB_IAC };
+
+// The epoll key of each fd of a line is the line's index and the fd's role.
+enum { ROLE_SOCK, ROLE_IN, ROLE_OUT };
+static const uint64_t stop_key = UINT64_MAX;
+
+// ^], which stops pidp11 from a terminal line.
+static const uint8_t escape_char = 0x1d;
+
+// How long to wait before connecting a line again, after the simulator
+// refused the connection or dropped it. A line it keeps dropping within
+// connect_stable_msec of connecting, as a multiplexer with no free line does,
+// waits twice as long each time, up to connect_backoff_msec.
+static const int connect_retry_msec = 100;
+static const int connect_backoff_msec = 5000;
+static const int connect_stable_msec = 1000;
+
+// What went wrong on a line: the connection to the simulator, which is
+// retried, or the local terminal, which closes the line.
+enum { LINE_OK = 0, LINE_DISCONNECTED = -1, LINE_FAILED = -2 };
+
+/**
+ * Answer an option negotiation. The simulator may turn on binary mode,
+ * suppress go ahead and echo on its side, and binary mode and suppress go
+ * ahead on ours; everything else is refused. A request for the state an
+ * option is already in is not answered, so negotiations do not loop.
+ *
+ * @param telnet the telnet receive state.
+ * @param option the option.
+ * @param reply the replies.
+ * @param reply_size the space for replies.
+ * @param reply_len the length of the replies.
+ */
+static void telnet_negotiate(pidp11_telnet_t *telnet, uint8_t option,
+                             uint8_t *reply, size_t reply_size,
+                             size_t *reply_len) {
+  int remote = telnet->command == TELNET_WILL || telnet->command == TELNET_WONT;
+  int enable = telnet->command == TELNET_WILL || telnet->command == TELNET_DO;
+  uint32_t *agreed = remote ? telnet->remote : telnet->local;
+  uint32_t bit = (uint32_t)1 << (option & 31);
+  int on = (agreed[option >> 5] & bit) != 0;
+  int supported = option == TELNET_BINARY || option == TELNET_SGA ||
+                  (remote && option == TELNET_ECHO);
+  uint8_t answer;
+
+  if (enable && supported) {
+    if (on) {
+      return;
+    }
+    agreed[option >> 5] |= bit;
+    answer = remote ? TELNET_DO : TELNET_WILL;
+  } else if (enable) {
+    answer = remote ? TELNET_DONT : TELNET_WONT;
+  } else {
+    if (!on) {
+      return;
+    }
+    agreed[option >> 5] &= ~bit;
+    answer = remote ? TELNET_DONT : TELNET_WONT;
+  }
+  if (*reply_len + 3 <= reply_size) {
+    reply[(*reply_len)++] = TELNET_IAC;
+    reply[(*reply_len)++] = answer;
+    reply[(*reply_len)++] = option;
+  }
+}
+
+size_t pidp11_telnet_receive(pidp11_telnet_t *telnet, uint8_t *data, size_t n,
+                             uint8_t *reply, size_t reply_size,
+                             size_t *reply_len) {
+  size_t out = 0;
+
+  *reply_len = 0;
+  for (size_t i = 0; i < n; i++) {
+    // Move runs of plain data in one go; they are all there is, mostly.
+    if (telnet->state == TELNET_DATA) {
+      uint8_t *iac = memchr(data + i, TELNET_IAC, n - i);
+      size_t run = (iac != NULL ? (size_t)(iac - data) : n) - i;
+      if (out != i) {
+        memmove(data + out, data + i, run);
+      }
+      out += run;
+      i += run;
+      if (i == n) {
+        break;
+      }
+    }
+    uint8_t c = data[i];
+    switch (telnet->state) {
+    case TELNET_DATA:
+      if (c == TELNET_IAC) {
+        telnet->state = TELNET_COMMAND;
+      } else {
+        data[out++] = c;
+      }
+      break;
+    case TELNET_COMMAND:
+      if (c == TELNET_IAC) {
+        data[out++] = c;
+        telnet->state = TELNET_DATA;
+      } else if (c >= TELNET_WILL && c <= TELNET_DONT) {
+        telnet->command = c;
+        telnet->state = TELNET_OPTION;
+      } else if (c == TELNET_SB) {
+        telnet->state = TELNET_SUB;
+      } else {
+        telnet->state = TELNET_DATA; // NOP, GA and the like.
+      }
+      break;
+    case TELNET_OPTION:
+      telnet_negotiate(telnet, c, reply, reply_size, reply_len);
+      telnet->state = TELNET_DATA;
+      break;
+    case TELNET_SUB:
+      if (c == TELNET_IAC) {
+        telnet->state = TELNET_SUB_IAC;
+      }
+      break;
+    case TELNET_SUB_IAC:
+      telnet->state = c == TELNET_SE ? TELNET_DATA : TELNET_SUB;
+      break;
+    }
+  }
+  return out;
+}
+
+size_t pidp11_telnet_escape(uint8_t *data, size_t n) {
+  size_t iacs = 0;
+  for (size_t i = 0; i < n; i++) {
+    iacs += data[i] == TELNET_IAC;
+  }
+  size_t j = n + iacs;
+  for (size_t i = n; i > 0 && j > i; i--) {
+    data[--j] = data[i - 1];
+    if (data[i - 1] == TELNET_IAC) {
+      data[--j] = TELNET_IAC;
+    }
+  }
+  return n + iacs;
+}
+
+int pidp11_console_find_port(const char *ini_path) {
+  FILE *ini = fopen(ini_path, "r");
+  char line[256];
+  int port = -1;
+
+  if (ini == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof line, ini) != NULL) {
+    for (char *s = line; *s != '\0'; s++) {
+      *s = tolower((unsigned char)*s);
+    }
+    char *telnet = strstr(line, "telnet=");
+    char *comment = strchr(line, ';');
+    if (telnet == NULL || (comment != NULL && comment < telnet) ||
+        strstr(line, "set") == NULL || strstr(line, "console") == NULL) {
+      continue;
+    }
+    // telnet=1030, or telnet=localhost:1030.
+    char *value = telnet + strlen("telnet=");
+    char *colon = strchr(value, ':');
+    if (colon != NULL) {
+      value = colon + 1;
+    }
+    if (isdigit((unsigned char)*value)) {
+      port = atoi(value);
+    }
+  }
+  fclose(ini);
+  return port;
+}
+
+// The terminal multiplexers to look for, and their lines when the
+// initialization file does not set them.
+static const struct {
+  const char *device;
+  int lines;
+} muxes[] = {{"dz", 8}, {"vh", 8}, {"dli", 1}};
+
+/**
+ * Find a terminal multiplexer's telnet port in a SimH initialization file,
+ * from its "attach" line, and its lines, from its "set ... lines=" line.
+ *
+ * @param ini_path the initialization file.
+ * @param device the multiplexer's device name.
+ * @param lines its lines, left unchanged if the file does not set them.
+ * @return the port, or -1 if it is not attached to one.
+ */
+static int find_mux(const char *ini_path, const char *device, int *lines) {
+  FILE *ini = fopen(ini_path, "r");
+  char line[256];
+  int port = -1;
+
+  if (ini == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof line, ini) != NULL) {
+    char *comment = strchr(line, ';');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    for (char *s = line; *s != '\0'; s++) {
+      *s = tolower((unsigned char)*s);
+    }
+    char *save;
+    char *command = strtok_r(line, " \t\r\n", &save);
+    char *token = strtok_r(NULL, " \t\r\n", &save);
+    while (token != NULL && *token == '-') {
+      token = strtok_r(NULL, " \t\r\n", &save); // attach switches
+    }
+    if (command == NULL || token == NULL || strcmp(token, device) != 0) {
+      continue;
+    }
+    char *value = strtok_r(NULL, " \t\r\n", &save);
+    if (value == NULL) {
+      continue;
+    }
+    if (strcmp(command, "at") == 0 || strcmp(command, "attach") == 0) {
+      // 1031, or localhost:1031.
+      char *colon = strchr(value, ':');
+      if (colon != NULL) {
+        value = colon + 1;
+      }
+      if (isdigit((unsigned char)*value)) {
+        port = atoi(value);
+      }
+    } else if (strcmp(command, "set") == 0 &&
+               strncmp(value, "lines=", strlen("lines=")) == 0) {
+      *lines = atoi(value + strlen("lines="));
+    }
+  }
+  fclose(ini);
+  return port;
+}
+
+int pidp11_console_add_muxes(pidp11_console_t *console, const char *ini_path,
+                             const char *dir) {
+  char link[sizeof console->lines[0].link];
+  int added = 0;
+
+  if (mkdir(dir, 0755) && errno != EEXIST) {
+    dir = NULL;
+  }
+  for (size_t i = 0; i < sizeof muxes / sizeof muxes[0]; i++) {
+    int lines = muxes[i].lines;
+    int port = find_mux(ini_path, muxes[i].device, &lines);
+    // The multiplexer gives each connection to its port the next free line,
+    // so the lines are connected in order.
+    for (int j = 0; port > 0 && j < lines; j++) {
+      if (dir != NULL) {
+        snprintf(link, sizeof link, "%s/tty%d", dir, added);
+      }
+      if (pidp11_console_add_pty(console, port, dir ? link : NULL) == NULL) {
+        return added;
+      }
+      added++;
+    }
+  }
+  return added;
+}
+
+int pidp11_console_init(pidp11_console_t *console) {
+  memset(console, 0, sizeof *console);
+  console->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  console->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  struct epoll_event event = {.events = EPOLLIN, .data.u64 = stop_key};
+  if (console->epoll_fd < 0 || console->stop_fd < 0 ||
+      epoll_ctl(console->epoll_fd, EPOLL_CTL_ADD, console->stop_fd, &event)) {
+    if (console->epoll_fd >= 0) {
+      close(console->epoll_fd);
+    }
+    if (console->stop_fd >= 0) {
+      close(console->stop_fd);
+    }
+    return -1;
+  }
+  return 0;
+}
+
+pidp11_console_line_t *pidp11_console_add(pidp11_console_t *console, int port,
+                                          int in_fd, int out_fd) {
+  if (console->n_lines == PIDP11_CONSOLE_MAX_LINES) {
+    return NULL;
+  }
+  pidp11_console_line_t *line = &console->lines[console->n_lines++];
+  memset(line, 0, sizeof *line);
+  line->port = port;
+  line->sock = -1;
+  line->in_fd = in_fd;
+  line->out_fd = out_fd;
+  return line;
+}
+
+int pidp11_console_add_tty(pidp11_console_t *console, int port) {
+  int fd = open("/dev/tty", O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  pidp11_console_line_t *line = pidp11_console_add(console, port, fd, fd);
+  if (line == NULL) {
+    close(fd);
+    return -1;
+  }
+  snprintf(line->name, sizeof line->name, "/dev/tty");
+  line->escape = 1;
+
+  // Raw input, so control characters go to the simulator, but keep output
+  // processing, so pidp11's own messages still start on a new line.
+  if (tcgetattr(fd, &line->saved) == 0) {
+    struct termios raw = line->saved;
+    cfmakeraw(&raw);
+    raw.c_oflag |= OPOST;
+    line->restore = tcsetattr(fd, TCSAFLUSH, &raw) == 0;
+  }
+  return 0;
+}
+
+/**
+ * Open a new pty, with the slave in raw mode. The slave is left closed, so
+ * the master reports a hangup once the last program to open it closes it.
+ *
+ * @param name the destination of the slave's path.
+ * @param size the size of name.
+ * @return the master fd, or -1 on failure.
+ */
+static int open_pty(char *name, size_t size) {
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0) {
+    return -1;
+  }
+  if (grantpt(master) || unlockpt(master) || ptsname_r(master, name, size) ||
+      fcntl(master, F_SETFL, O_NONBLOCK) ||
+      fcntl(master, F_SETFD, FD_CLOEXEC)) {
+    close(master);
+    return -1;
+  }
+  // The settings made through the master are the slave's.
+  struct termios raw;
+  if (tcgetattr(master, &raw) == 0) {
+    cfmakeraw(&raw);
+    tcsetattr(master, TCSANOW, &raw);
+  }
+  return master;
+}
+
+pidp11_console_line_t *
+pidp11_console_add_pty(pidp11_console_t *console, int port, const char *link) {
+  char name[sizeof console->lines[0].name];
+  int master = open_pty(name, sizeof name);
+  if (master < 0) {
+    return NULL;
+  }
+  pidp11_console_line_t *line =
+      pidp11_console_add(console, port, master, master);
+  if (line == NULL) {
+    close(master);
+    return NULL;
+  }
+  line->pty = 1;
+  snprintf(line->name, sizeof line->name, "%s", name);
+  if (link != NULL) {
+    unlink(link);
+    if (symlink(name, link) == 0) {
+      snprintf(line->link, sizeof line->link, "%s", link);
+    }
+  }
+  return line;
+}
+
+static int64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t line_key(pidp11_console_t *console,
+                         pidp11_console_line_t *line, int role) {
+  return (uint64_t)(line - console->lines) << 2 | role;
+}
+
+static int buffer_empty(const pidp11_console_buffer_t *buffer) {
+  return buffer->start == buffer->end;
+}
+
+/**
+ * Change the events an fd of a line waits for, if they changed.
+ *
+ * @param console the console data structure.
+ * @param line the line.
+ * @param role the fd's role.
+ * @param fd the fd.
+ * @param current the events it waits for now.
+ * @param events the events to wait for.
+ */
+static void line_watch(pidp11_console_t *console, pidp11_console_line_t *line,
+                       int role, int fd, uint32_t *current, uint32_t events) {
+  if (*current == events) {
+    return;
+  }
+  struct epoll_event event = {.events = events,
+                              .data.u64 = line_key(console, line, role)};
+  epoll_ctl(console->epoll_fd, EPOLL_CTL_MOD, fd, &event);
+  *current = events;
+}
+
+/**
+ * Wait to read a source only while the buffer it fills is empty, and to
+ * write a destination only while the buffer it drains is not.
+ *
+ * @param console the console data structure.
+ * @param line the line.
+ */
+static void line_update(pidp11_console_t *console,
+                        pidp11_console_line_t *line) {
+  uint32_t sock_events = (buffer_empty(&line->to_local) ? EPOLLIN : 0) |
+                         (buffer_empty(&line->to_sock) ? 0 : EPOLLOUT);
+  uint32_t in_events = buffer_empty(&line->to_sock) ? EPOLLIN : 0;
+  uint32_t out_events = buffer_empty(&line->to_local) ? 0 : EPOLLOUT;
+
+  line_watch(console, line, ROLE_SOCK, line->sock, &line->sock_events,
+             sock_events);
+  if (line->out_fd == line->in_fd) {
+    line_watch(console, line, ROLE_IN, line->in_fd, &line->in_events,
+               in_events | out_events);
+  } else {
+    line_watch(console, line, ROLE_IN, line->in_fd, &line->in_events,
+               in_events);
+    line_watch(console, line, ROLE_OUT, line->out_fd, &line->out_events,
+               out_events);
+  }
+}
+
+/**
+ * Drop a line's connection, and what was on its way through it. The line
+ * reconnects once the simulator listens again, as a multiplexer does when a
+ * session hangs up, after a wait that grows while the connections keep
+ * dropping at once.
+ *
+ * @param console the console data structure.
+ * @param line the line.
+ */
+static void line_disconnect(pidp11_console_t *console,
+                            pidp11_console_line_t *line) {
+  int64_t now = now_ns();
+  if (now - line->connected_ns < connect_stable_msec * 1000000LL &&
+      line->retry_msec != 0) {
+    line->retry_msec *= 2;
+    if (line->retry_msec > connect_backoff_msec) {
+      line->retry_msec = connect_backoff_msec;
+    }
+  } else {
+    line->retry_msec = connect_retry_msec;
+  }
+  line->retry_ns = now + line->retry_msec * 1000000LL;
+
+  epoll_ctl(console->epoll_fd, EPOLL_CTL_DEL, line->sock, NULL);
+  epoll_ctl(console->epoll_fd, EPOLL_CTL_DEL, line->in_fd, NULL);
+  if (line->out_fd != line->in_fd) {
+    epoll_ctl(console->epoll_fd, EPOLL_CTL_DEL, line->out_fd, NULL);
+  }
+  close(line->sock);
+  line->sock = -1;
+  memset(&line->telnet, 0, sizeof line->telnet);
+  line->to_local.start = line->to_local.end = 0;
+  line->to_sock.start = line->to_sock.end = 0;
+}
+
+/**
+ * Close a line for good, after its local terminal failed.
+ *
+ * @param console the console data structure.
+ * @param line the line.
+ */
+static void line_close(pidp11_console_t *console,
+                       pidp11_console_line_t *line) {
+  line_disconnect(console, line);
+  line->closed = 1;
+}
+
+/**
+ * Hang up a pty line after the last program using its pty closed it: drop
+ * the connection, so the simulator hangs up the session, and give the line a
+ * new pty, so the next user starts a new session and sees nothing left from
+ * the old one. The old pty would report a hangup until it was opened again.
+ *
+ * @param console the console data structure.
+ * @param line the line.
+ */
+static void line_hangup(pidp11_console_t *console,
+                        pidp11_console_line_t *line) {
+  char name[sizeof line->name];
+  int master = open_pty(name, sizeof name);
+  if (master < 0) {
+    line_close(console, line);
+    return;
+  }
+  line_disconnect(console, line);
+  close(line->in_fd);
+  line->in_fd = line->out_fd = master;
+  snprintf(line->name, sizeof line->name, "%s", name);
+  if (line->link[0] != '\0') {
+    unlink(line->link);
+    if (symlink(name, line->link)) {
+      line->link[0] = '\0';
+    }
+  }
+}
+
+/**
+ * Write as much of a buffer as the fd takes.
+ *
+ * @param buffer the buffer.
+ * @param fd the fd.
+ * @return zero, or -1 if the fd failed.
+ */
+static int buffer_flush(pidp11_console_buffer_t *buffer, int fd) {
+  while (!buffer_empty(buffer)) {
+    ssize_t n =
+        write(fd, buffer->data + buffer->start, buffer->end - buffer->start);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    }
+    buffer->start += n;
+  }
+  buffer->start = buffer->end = 0;
+  return 0;
+}
+
+/**
+ * Read from the simulator, strip the telnet commands, and pass the rest to
+ * the terminal.
+ *
+ * @param line the line.
+ * @return LINE_OK, LINE_DISCONNECTED or LINE_FAILED.
+ */
+static int line_receive(pidp11_console_line_t *line) {
+  pidp11_console_buffer_t *in = &line->to_local;
+  pidp11_console_buffer_t *replies = &line->to_sock;
+
+  if (!buffer_empty(in)) {
+    return 0;
+  }
+  ssize_t n = read(line->sock, in->data, sizeof in->data);
+  if (n <= 0) {
+    return n < 0 && (errno == EAGAIN || errno == EINTR) ? LINE_OK
+                                                        : LINE_DISCONNECTED;
+  }
+  line->bytes_in += n;
+  size_t reply_len;
+  in->start = 0;
+  in->end = pidp11_telnet_receive(&line->telnet, in->data, n,
+                                  replies->data + replies->end,
+                                  sizeof replies->data - replies->end,
+                                  &reply_len);
+  replies->end += reply_len;
+  if (buffer_flush(in, line->out_fd)) {
+    return LINE_FAILED;
+  }
+  return buffer_flush(replies, line->sock) ? LINE_DISCONNECTED : LINE_OK;
+}
+
+/**
+ * Read from the terminal, escape it, and pass it to the simulator. On a
+ * line with the escape character, the character raises SIGINT.
+ *
+ * @param line the line.
+ * @return LINE_OK, LINE_DISCONNECTED or LINE_FAILED.
+ */
+static int line_send(pidp11_console_line_t *line) {
+  pidp11_console_buffer_t *out = &line->to_sock;
+
+  if (!buffer_empty(out)) {
+    return 0;
+  }
+  // Leave room to double every byte.
+  out->start = out->end = 0;
+  ssize_t n = read(line->in_fd, out->data, sizeof out->data / 2);
+  if (n <= 0) {
+    return n < 0 && (errno == EAGAIN || errno == EINTR) ? LINE_OK
+                                                        : LINE_FAILED;
+  }
+  if (line->escape && memchr(out->data, escape_char, n) != NULL) {
+    size_t kept = 0;
+    for (ssize_t i = 0; i < n; i++) {
+      if (out->data[i] != escape_char) {
+        out->data[kept++] = out->data[i];
+      }
+    }
+    n = kept;
+    kill(getpid(), SIGINT);
+  }
+  atomic_fetch_add_explicit(&line->bytes_out, n, memory_order_relaxed);
+  out->end = pidp11_telnet_escape(out->data, n);
+  return buffer_flush(out, line->sock) ? LINE_DISCONNECTED : LINE_OK;
+}
+
+/**
+ * Connect the lines the simulator now listens for, of those due to try.
+ *
+ * @param console the console data structure.
+ * @return the milliseconds until the next line is due to try again, or -1
+ *         if none is waiting.
+ */
+static int pidp11_console_connect(pidp11_console_t *console) {
+  int64_t now = now_ns();
+  int64_t next = -1;
+
+  for (int i = 0; i < console->n_lines; i++) {
+    pidp11_console_line_t *line = &console->lines[i];
+    if (line->sock >= 0 || line->closed) {
+      continue;
+    }
+    if (line->retry_ns > now) {
+      if (next < 0 || line->retry_ns < next) {
+        next = line->retry_ns;
+      }
+      continue;
+    }
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_port = htons(line->port),
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof addr)) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      line->retry_ns = now + connect_retry_msec * 1000000LL;
+      if (next < 0 || line->retry_ns < next) {
+        next = line->retry_ns;
+      }
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    line->sock = fd;
+    line->connected_ns = now;
+
+    struct epoll_event event = {.events = 0};
+    event.data.u64 = line_key(console, line, ROLE_SOCK);
+    epoll_ctl(console->epoll_fd, EPOLL_CTL_ADD, line->sock, &event);
+    event.data.u64 = line_key(console, line, ROLE_IN);
+    epoll_ctl(console->epoll_fd, EPOLL_CTL_ADD, line->in_fd, &event);
+    if (line->out_fd != line->in_fd) {
+      event.data.u64 = line_key(console, line, ROLE_OUT);
+      epoll_ctl(console->epoll_fd, EPOLL_CTL_ADD, line->out_fd, &event);
+    }
+    line->sock_events = line->in_events = line->out_events = 0;
+    line_update(console, line);
+  }
+  return next < 0 ? -1 : (int)((next - now + 999999) / 1000000);
+}
+
+static void pidp11_console_service(pidp11_console_t *console,
+                                   pidp11_console_line_t *line, int role,
+                                   uint32_t events) {
+  int status = LINE_OK;
+
+  if (line->closed || line->sock < 0) {
+    return;
+  }
+  // A hangup with nothing left to read, perhaps because the buffer it would
+  // fill is waiting on the other side, would otherwise be reported again
+  // and again.
+  if ((events & (EPOLLHUP | EPOLLERR)) && !(events & EPOLLIN)) {
+    status = role == ROLE_SOCK ? LINE_DISCONNECTED : LINE_FAILED;
+  } else if (role == ROLE_SOCK) {
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+      status = line_receive(line);
+    }
+    if (status == LINE_OK && (events & EPOLLOUT) &&
+        buffer_flush(&line->to_sock, line->sock)) {
+      status = LINE_DISCONNECTED;
+    }
+  } else {
+    if (role == ROLE_IN && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+      status = line_send(line);
+    }
+    if (status == LINE_OK && (events & EPOLLOUT) &&
+        buffer_flush(&line->to_local, line->out_fd)) {
+      status = LINE_FAILED;
+    }
+  }
+  if (status == LINE_DISCONNECTED) {
+    line_disconnect(console, line);
+  } else if (status == LINE_FAILED && line->pty) {
+    line_hangup(console, line);
+  } else if (status == LINE_FAILED) {
+    line_close(console, line);
+  } else {
+    line_update(console, line);
+  }
+}
+
+static void *pidp11_console_run(void *arg) {
+  pidp11_console_t *console = (pidp11_console_t *)arg;
+  // Room for every fd of every line, so one wakeup serves them all.
+  struct epoll_event events[3 * PIDP11_CONSOLE_MAX_LINES + 1];
+  int max_events = sizeof events / sizeof events[0];
+
+  for (;;) {
+    int timeout = pidp11_console_connect(console);
+    int n = epoll_wait(console->epoll_fd, events, max_events, timeout);
+    for (int i = 0; i < n; i++) {
+      uint64_t key = events[i].data.u64;
+      if (key == stop_key) {
+        return NULL;
+      }
+      pidp11_console_service(console, &console->lines[key >> 2], key & 3,
+                             events[i].events);
+    }
+  }
+}
+
+uint64_t pidp11_console_bytes_sent(pidp11_console_t *console) {
+  uint64_t sent = 0;
+  for (int i = 0; i < console->n_lines; i++) {
+    sent += atomic_load_explicit(&console->lines[i].bytes_out,
+                                 memory_order_relaxed);
+  }
+  return sent;
+}
+
+int pidp11_console_start(pidp11_console_t *console) {
+  if (pthread_create(&console->thread, NULL, pidp11_console_run, console)) {
+    return -1;
+  }
+  console->started = 1;
+  return 0;
+}
+
+int pidp11_console_stop(pidp11_console_t *console) {
+  if (console->started) {
+    uint64_t one = 1;
+    if (write(console->stop_fd, &one, sizeof one) != sizeof one) {
+      return -1;
+    }
+    pthread_join(console->thread, NULL);
+    console->started = 0;
+  }
+  for (int i = 0; i < console->n_lines; i++) {
+    pidp11_console_line_t *line = &console->lines[i];
+    if (line->sock >= 0) {
+      close(line->sock);
+    }
+    if (line->restore) {
+      tcsetattr(line->in_fd, TCSAFLUSH, &line->saved);
+    }
+    close(line->in_fd);
+    if (line->out_fd != line->in_fd) {
+      close(line->out_fd);
+    }
+    if (line->link[0] != '\0') {
+      unlink(line->link);
+    }
+  }
+  console->n_lines = 0;
+  close(console->epoll_fd);
+  close(console->stop_fd);
+  return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PIDP11_CONSOLE_H
+#define PIDP11_CONSOLE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <termios.h>
+
+/*
+ * Relay the simulator's telnet terminal lines to local terminals: the
+ * controlling terminal, or a pty. One thread serves every line with epoll,
+ * handling every ready line at each wakeup. It connects each line as soon
+ * as the simulator listens, and again after the simulator drops it, as a
+ * multiplexer does when a session hangs up; when the user of a pty closes
+ * it, its line drops the connection, hanging up the session in turn. It
+ * strips the telnet commands from what the simulator sends, answers its
+ * option negotiation, and escapes what is sent to it. Each direction of a
+ * line has one buffer; while it holds data the destination has not taken,
+ * its source is not read, so a slow terminal holds back the simulator
+ * rather than being polled.
+ */
+
+#define PIDP11_CONSOLE_MAX_LINES 32
+#define PIDP11_CONSOLE_BUFFER 16384
+
+/**
+ * Telnet receive state: where the parser is in a command, and the options
+ * agreed in each direction, one bit per option.
+ */
+typedef struct _pidp11_telnet_t {
+  int state;
+  uint8_t command;
+  uint32_t local[8];
+  uint32_t remote[8];
+} pidp11_telnet_t;
+
+typedef struct _pidp11_console_buffer_t {
+  uint8_t data[PIDP11_CONSOLE_BUFFER];
+  size_t start;
+  size_t end;
+} pidp11_console_buffer_t;
+
+typedef struct _pidp11_console_line_t {
+  // The simulator's port, and the connection to it, or -1 until connected,
+  // and after it closes.
+  int port;
+  int sock;
+  char closed;
+
+  // When the connection was made, and when to try again after it failed or
+  // dropped, on the CLOCK_MONOTONIC clock, and the wait before that try.
+  int64_t connected_ns;
+  int64_t retry_ns;
+  int retry_msec;
+
+  // The local terminal: the fds to read and write, the same for a pty
+  // master; whether it is a pty, replaced when its user hangs up; and the
+  // terminal's name and link.
+  int in_fd;
+  int out_fd;
+  char pty;
+  char name[64];
+  char link[108];
+
+  // Whether the escape character, ^], stops pidp11, and the terminal
+  // settings to restore.
+  char escape;
+  char restore;
+  struct termios saved;
+
+  // The epoll events each fd is waiting for.
+  uint32_t sock_events;
+  uint32_t in_events;
+  uint32_t out_events;
+
+  pidp11_telnet_t telnet;
+  pidp11_console_buffer_t to_local;
+  pidp11_console_buffer_t to_sock;
+
+  // Bytes relayed from and to the simulator; those to it are read by other
+  // threads, through pidp11_console_bytes_sent().
+  uint64_t bytes_in;
+  _Atomic uint64_t bytes_out;
+} pidp11_console_line_t;
+
+typedef struct _pidp11_console_t {
+  int n_lines;
+  pidp11_console_line_t lines[PIDP11_CONSOLE_MAX_LINES];
+  int epoll_fd;
+  int stop_fd;
+  char started;
+  pthread_t thread;
+} pidp11_console_t;
+
+/**
+ * Strip telnet commands from data received, in place, and queue the
+ * replies to option negotiations.
+ *
+ * @param[in] telnet The telnet receive state.
+ * @param[in] data The data received.
+ * @param[in] n The length of the data.
+ * @param[out] reply The replies to send.
+ * @param[in] reply_size The space for replies; replies that do not fit are
+ *                       dropped.
+ * @param[out] reply_len The length of the replies.
+ * @return the length of the data left.
+ */
+size_t pidp11_telnet_receive(pidp11_telnet_t *telnet, uint8_t *data, size_t n,
+                             uint8_t *reply, size_t reply_size,
+                             size_t *reply_len);
+
+/**
+ * Escape data to send, in place, by doubling each IAC byte. There must be
+ * room for n more bytes after the data.
+ *
+ * @param[in] data The data.
+ * @param[in] n The length of the data.
+ * @return the escaped length.
+ */
+size_t pidp11_telnet_escape(uint8_t *data, size_t n);
+
+/**
+ * Find the console's telnet port in a SimH initialization file, from its
+ * "set console telnet=" line.
+ *
+ * @param[in] ini_path The initialization file.
+ * @return the port, or -1 if there is none.
+ */
+int pidp11_console_find_port(const char *ini_path);
+
+/**
+ * Initialize a console bridge with no lines.
+ *
+ * @param[out] console The console data structure.
+ * @return zero on success.
+ */
+int pidp11_console_init(pidp11_console_t *console);
+
+/**
+ * Add a line that relays a simulator port to a pair of local fds. The fds
+ * must be non-blocking, and are closed when the bridge stops.
+ *
+ * @param[in] console The console data structure.
+ * @param[in] port The simulator's telnet port on localhost.
+ * @param[in] in_fd The fd to read from.
+ * @param[in] out_fd The fd to write to, which may be in_fd.
+ * @return the line, or NULL if there is no room for it.
+ */
+pidp11_console_line_t *pidp11_console_add(pidp11_console_t *console, int port,
+                                          int in_fd, int out_fd);
+
+/**
+ * Add a line that relays a simulator port to the controlling terminal. The
+ * terminal is put in raw mode until the bridge stops, so control characters
+ * go to the simulator; ^] stops pidp11 by raising SIGINT.
+ *
+ * @param[in] console The console data structure.
+ * @param[in] port The simulator's telnet port on localhost.
+ * @return zero on success.
+ */
+int pidp11_console_add_tty(pidp11_console_t *console, int port);
+
+/**
+ * Add a line that relays a simulator port to a new pty. Once the last
+ * program using the pty closes it, the line drops its connection, so the
+ * simulator hangs up the session, and moves to another new pty and its link.
+ *
+ * @param[in] console The console data structure.
+ * @param[in] port The simulator's telnet port on localhost.
+ * @param[in] link A path to link to the pty, replacing whatever is there, or
+ *                 NULL.
+ * @return the line, or NULL on failure. Its name is the pty's path.
+ */
+pidp11_console_line_t *
+pidp11_console_add_pty(pidp11_console_t *console, int port, const char *link);
+
+/**
+ * Add a pty line for each line of the terminal multiplexers attached to
+ * telnet ports in a SimH initialization file: DZ11 (dz), DHV11 (vh) and
+ * DL11 (dli). The lines are linked in a directory, created if need be, as
+ * tty0, tty1 and so on.
+ *
+ * @param[in] console The console data structure.
+ * @param[in] ini_path The initialization file.
+ * @param[in] dir The directory for the links.
+ * @return the number of lines added.
+ */
+int pidp11_console_add_muxes(pidp11_console_t *console, const char *ini_path,
+                             const char *dir);
+
+/**
+ * Get the number of bytes relayed to the simulator on every line, such as
+ * commands typed at its prompt. It may be called while the bridge runs.
+ *
+ * @param[in] console The console data structure.
+ * @return the number of bytes.
+ */
+uint64_t pidp11_console_bytes_sent(pidp11_console_t *console);
+
+/**
+ * Start the bridge thread. It connects each line once the simulator
+ * listens on its port, retrying every 100 ms until then. After the simulator
+ * drops a line, it waits 100 ms before connecting it again, twice as long
+ * each time the simulator drops it within a second, up to 5 s.
+ *
+ * @param[in] console The console data structure.
+ * @return zero on success.
+ */
+int pidp11_console_start(pidp11_console_t *console);
+
+/**
+ * Stop the bridge, close the lines, restore the terminal and remove the pty
+ * links.
+ *
+ * @param[in] console The console data structure.
+ * @return zero on success.
+ */
+int pidp11_console_stop(pidp11_console_t *console);
+#endif
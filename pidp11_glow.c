@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pidp11_glow.h"
+
+// Bounds on the settings. SimH's sampling cost grows with the sample rate,
+// and its per-bit counts with the depth.
+static const int min_sample_interval = 100;
+static const int max_sample_depth = 1024;
+static const int max_decay_shift = 8;
+
+// The address lamps come first in the intensities, then the data lamps.
+static const int address_lamps = 22;
+static const int data_lamps = 16;
+
+static int64_t now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void pidp11_glow_init(pidp11_glow_t *glow) {
+  memset(glow, 0, sizeof *glow);
+  glow->sample_interval = 5000;
+  glow->sample_depth = 32;
+  glow->decay_shift = 2;
+  pidp11_glow_reset(glow);
+}
+
+/**
+ * Read an integer setting from the environment, and clamp it.
+ *
+ * @param name the environment variable.
+ * @param value the setting, left unchanged if the variable is not set.
+ * @param min the smallest value.
+ * @param max the largest value.
+ */
+static void getenv_clamped(const char *name, unsigned int *value, int min,
+                           int max) {
+  const char *s = getenv(name);
+  if (s != NULL && *s != '\0') {
+    int v = atoi(s);
+    *value = v < min ? min : v > max ? max : v;
+  }
+}
+
+void pidp11_glow_load_env(pidp11_glow_t *glow) {
+  const char *s = getenv("PIDP11_GLOW_SAMPLE");
+  if (s != NULL && atoi(s) <= 0) {
+    glow->sample_interval = 0;
+  } else {
+    getenv_clamped("PIDP11_GLOW_SAMPLE", &glow->sample_interval,
+                   min_sample_interval, 1000000000);
+  }
+  getenv_clamped("PIDP11_GLOW_DEPTH", &glow->sample_depth, 1,
+                 max_sample_depth);
+  getenv_clamped("PIDP11_GLOW_DECAY", &glow->decay_shift, 0, max_decay_shift);
+  pidp11_glow_reset(glow);
+}
+
+void pidp11_glow_reset(pidp11_glow_t *glow) {
+  memset(glow->level, 0, sizeof glow->level);
+  glow->scale = (PIDP11_GLOW_MAX << 8) / glow->sample_depth;
+}
+
+/**
+ * Move a run of lamp intensities towards their bit counts.
+ *
+ * @param glow the glow data structure.
+ * @param level the intensities.
+ * @param counts the bit counts.
+ * @param n the number of bit counts.
+ * @param lamps the number of lamps; the ones past n fade out.
+ */
+static void glow_lamps(pidp11_glow_t *glow, uint16_t *level, const int *counts,
+                       int n, int lamps) {
+  for (int i = 0; i < lamps; i++) {
+    int32_t target = i < n ? (int32_t)counts[i] * glow->scale : 0;
+    level[i] += (target - (int32_t)level[i]) >> glow->decay_shift;
+  }
+}
+
+void pidp11_glow_update(pidp11_glow_t *glow, const int *address, int n_address,
+                        const int *data, int n_data, uint8_t *out) {
+  int64_t start = now_ns();
+
+  glow_lamps(glow, glow->level, address, n_address, address_lamps);
+  glow_lamps(glow, glow->level + address_lamps, data, n_data, data_lamps);
+  for (int i = 0; i < PIDP11_GLOW_LAMPS; i++) {
+    out[i] = glow->level[i] >> 8;
+  }
+
+  int64_t elapsed = now_ns() - start;
+  glow->updates++;
+  glow->total_ns += elapsed;
+  if (elapsed > glow->max_ns) {
+    glow->max_ns = elapsed;
+  }
+}
+
+void pidp11_glow_print(const pidp11_glow_t *glow, FILE *out) {
+  if (glow->sample_interval == 0) {
+    return;
+  }
+  fprintf(out,
+          "PiDP11: glow: a sample every %u instructions, depth %u, decay "
+          "shift %u\n",
+          glow->sample_interval, glow->sample_depth, glow->decay_shift);
+  if (glow->updates > 0) {
+    fprintf(out, "PiDP11: glow: %llu updates, avg %.0f ns, max %lld ns\n",
+            (unsigned long long)glow->updates,
+            (double)glow->total_ns / glow->updates, (long long)glow->max_ns);
+  }
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PIDP11_GLOW_H
+#define PIDP11_GLOW_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pidp11.h"
+
+/*
+ * Lamp glow from sampled register bits. SimH samples the registers behind
+ * the address and data lamps every sample_interval instructions, and
+ * reports how many of the last sample_depth samples had each bit set. Each
+ * lamp keeps an intensity that moves a fraction of the way towards its
+ * bit's share of the samples at each display callback, so a lamp brightens
+ * and fades over a few callbacks, like an incandescent bulb, rather than
+ * showing one sample per callback.
+ */
+
+typedef struct _pidp11_glow_t {
+  // Sampling settings: the instructions between samples, or zero to not
+  // sample; the samples each bit count is taken over; and the fraction of
+  // the way a lamp moves towards its target at each update, as a shift.
+  unsigned int sample_interval;
+  unsigned int sample_depth;
+  unsigned int decay_shift;
+
+  // The intensity of each lamp, PIDP11_GLOW_MAX << 8 for fully lit, and
+  // the scale from a bit count to an intensity.
+  uint16_t level[PIDP11_GLOW_LAMPS];
+  uint32_t scale;
+
+  // The cost of the updates, in nanoseconds.
+  uint64_t updates;
+  uint64_t total_ns;
+  int64_t max_ns;
+} pidp11_glow_t;
+
+/**
+ * Set the default glow settings.
+ *
+ * @param[out] glow The glow data structure.
+ */
+void pidp11_glow_init(pidp11_glow_t *glow);
+
+/**
+ * Override the glow settings from the environment:
+ *
+ *   PIDP11_GLOW_SAMPLE  instructions between samples, or 0 to not sample
+ *   PIDP11_GLOW_DEPTH   samples each bit count is taken over
+ *   PIDP11_GLOW_DECAY   how slowly lamps brighten and fade, as a shift
+ *
+ * Settings out of range are clamped, so the sampling cost stays bounded.
+ *
+ * @param[in] glow The glow data structure.
+ */
+void pidp11_glow_load_env(pidp11_glow_t *glow);
+
+/**
+ * Darken the lamps and get ready for updates with the current settings.
+ *
+ * @param[in] glow The glow data structure.
+ */
+void pidp11_glow_reset(pidp11_glow_t *glow);
+
+/**
+ * Move the lamp intensities towards the sampled bit counts, and write them
+ * out. The address lamps past n_address, and the data lamps past n_data,
+ * fade out.
+ *
+ * @param[in] glow The glow data structure.
+ * @param[in] address The bit counts for the address lamps, bit zero first.
+ * @param[in] n_address The number of address bit counts.
+ * @param[in] data The bit counts for the data lamps, bit zero first.
+ * @param[in] n_data The number of data bit counts.
+ * @param[out] out The lamp intensities, as in pidp11_t glow.
+ */
+void pidp11_glow_update(pidp11_glow_t *glow, const int *address, int n_address,
+                        const int *data, int n_data, uint8_t *out);
+
+/**
+ * Print the glow settings and update cost.
+ *
+ * @param[in] glow The glow data structure.
+ * @param[in] out The stream to print to.
+ */
+void pidp11_glow_print(const pidp11_glow_t *glow, FILE *out);
+#endif
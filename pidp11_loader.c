@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pidp11_loader.h"
+
+// The top of the 22-bit physical address space.
+static const uint32_t max_address = 017777777;
+
+// The words a run starts with room for.
+static const size_t initial_words = 64;
+
+// Absolute loader tape blocks start with 001 000, then the byte count and
+// load address, little endian, which the count includes.
+static const size_t tape_header = 6;
+
+void pidp11_image_init(pidp11_image_t *image) {
+  memset(image, 0, sizeof *image);
+}
+
+void pidp11_image_free(pidp11_image_t *image) {
+  for (size_t i = 0; i < image->n_runs; i++) {
+    free(image->runs[i].words);
+    free(image->runs[i].masks);
+  }
+  free(image->runs);
+  pidp11_image_init(image);
+}
+
+static int run_contains(const pidp11_load_run_t *run, uint32_t word) {
+  return word >= run->address && word < run->address + 2 * run->n_words;
+}
+
+static int run_ends_at(const pidp11_load_run_t *run, uint32_t word) {
+  return word == run->address + 2 * run->n_words;
+}
+
+static pidp11_load_run_t *new_run(pidp11_image_t *image, uint32_t word) {
+  if (image->n_runs == image->capacity) {
+    size_t capacity = image->capacity ? 2 * image->capacity : 4;
+    pidp11_load_run_t *runs =
+        realloc(image->runs, capacity * sizeof(pidp11_load_run_t));
+    if (runs == NULL) {
+      return NULL;
+    }
+    image->runs = runs;
+    image->capacity = capacity;
+  }
+  image->last = image->n_runs++;
+  pidp11_load_run_t *run = &image->runs[image->last];
+  memset(run, 0, sizeof *run);
+  run->address = word;
+  return run;
+}
+
+/**
+ * Find the run a word belongs in: one holding it already, or one it would
+ * carry on, or else a new one.
+ */
+static pidp11_load_run_t *find_run(pidp11_image_t *image, uint32_t word) {
+  if (image->n_runs > 0 && run_contains(&image->runs[image->last], word)) {
+    return &image->runs[image->last];
+  }
+  for (size_t i = 0; i < image->n_runs; i++) {
+    if (run_contains(&image->runs[i], word)) {
+      image->last = i;
+      return &image->runs[i];
+    }
+  }
+  if (image->n_runs > 0 && run_ends_at(&image->runs[image->last], word)) {
+    return &image->runs[image->last];
+  }
+  for (size_t i = 0; i < image->n_runs; i++) {
+    if (run_ends_at(&image->runs[i], word)) {
+      image->last = i;
+      return &image->runs[i];
+    }
+  }
+  return new_run(image, word);
+}
+
+/**
+ * Get the index of a word in its run, adding it to the end of the run if it
+ * is new.
+ */
+static int find_word(pidp11_image_t *image, uint32_t word,
+                     pidp11_load_run_t **found, size_t *index) {
+  pidp11_load_run_t *run = find_run(image, word);
+  if (run == NULL) {
+    return -1;
+  }
+  size_t i = (word - run->address) / 2;
+  if (i == run->n_words) {
+    if (run->n_words == run->capacity) {
+      size_t capacity = run->capacity ? 2 * run->capacity : initial_words;
+      uint16_t *words = realloc(run->words, capacity * sizeof(uint16_t));
+      if (words == NULL) {
+        return -1;
+      }
+      run->words = words;
+      uint8_t *masks = realloc(run->masks, capacity);
+      if (masks == NULL) {
+        return -1;
+      }
+      run->masks = masks;
+      run->capacity = capacity;
+    }
+    run->words[i] = 0;
+    run->masks[i] = 0;
+    run->n_words++;
+  }
+  *found = run;
+  *index = i;
+  return 0;
+}
+
+int pidp11_image_put_byte(pidp11_image_t *image, uint32_t address,
+                          uint8_t value) {
+  pidp11_load_run_t *run;
+  size_t i;
+  if (address > max_address || find_word(image, address & ~1u, &run, &i)) {
+    return -1;
+  }
+  int shift = (address & 1) * 8;
+  run->words[i] = (run->words[i] & ~(0xff << shift)) | (value << shift);
+  run->masks[i] |= 1 << (address & 1);
+  return 0;
+}
+
+int pidp11_image_put_word(pidp11_image_t *image, uint32_t address,
+                          uint16_t value) {
+  pidp11_load_run_t *run;
+  size_t i;
+  if (address > max_address || (address & 1) ||
+      find_word(image, address, &run, &i)) {
+    return -1;
+  }
+  run->words[i] = value;
+  run->masks[i] = 3;
+  return 0;
+}
+
+int pidp11_image_parse_tape(pidp11_image_t *image, const uint8_t *tape,
+                            size_t length) {
+  size_t i = 0;
+  for (;;) {
+    while (i < length && tape[i] == 0) {
+      i++; // blank tape.
+    }
+    if (length - i < tape_header || tape[i] != 1 || tape[i + 1] != 0) {
+      return -1;
+    }
+    size_t count = tape[i + 2] | tape[i + 3] << 8;
+    if (count < tape_header || length - i <= count) {
+      return -1;
+    }
+    uint8_t sum = 0;
+    for (size_t j = 0; j <= count; j++) {
+      sum += tape[i + j];
+    }
+    if (sum != 0) {
+      return -1;
+    }
+
+    uint32_t address = tape[i + 4] | tape[i + 5] << 8;
+    if (count == tape_header) {
+      image->has_start = !(address & 1);
+      image->start = address;
+      return 0;
+    }
+    for (size_t j = tape_header; j < count; j++) {
+      if (pidp11_image_put_byte(image, address + j - tape_header,
+                                tape[i + j])) {
+        return -1;
+      }
+    }
+    i += count + 1;
+  }
+}
+
+static int is_octal(char c) { return c >= '0' && c <= '7'; }
+
+static int end_of_word(char c) {
+  return c == '\0' || isspace((unsigned char)c);
+}
+
+int pidp11_image_parse_listing(pidp11_image_t *image, const char *text,
+                               int *error_line) {
+  int have_location = 0;
+  uint32_t location = 0;
+  int line = 1;
+
+  for (const char *p = text; *p; line++) {
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    const char *q = p;
+    while (is_octal(*q)) {
+      q++;
+    }
+    if (q > p && (*q == ':' || *q == '/')) {
+      unsigned long address = strtoul(p, NULL, 8);
+      if (address > max_address || (address & 1)) {
+        goto bad_line;
+      }
+      location = address;
+      have_location = 1;
+      p = q + 1;
+    }
+
+    for (;;) {
+      while (*p == ' ' || *p == '\t') {
+        p++;
+      }
+      for (q = p; is_octal(*q); q++) {
+      }
+      if (q == p || !end_of_word(*q)) {
+        break; // the instruction, or the end of the line.
+      }
+      unsigned long value = strtoul(p, NULL, 8);
+      if (!have_location || value > 0177777 ||
+          pidp11_image_put_word(image, location, value)) {
+        goto bad_line;
+      }
+      location += 2;
+      p = q;
+    }
+
+    p = strchr(p, '\n');
+    if (p == NULL) {
+      break;
+    }
+    p++;
+  }
+  return 0;
+
+bad_line:
+  if (error_line != NULL) {
+    *error_line = line;
+  }
+  return -1;
+}
+
+int pidp11_image_read(pidp11_image_t *image, const char *path,
+                      int *error_line) {
+  if (error_line != NULL) {
+    *error_line = 0;
+  }
+  FILE *in = fopen(path, "rb");
+  if (in == NULL) {
+    return -1;
+  }
+  size_t length = 0;
+  size_t capacity = 4096;
+  uint8_t *data = malloc(capacity);
+  while (data != NULL) {
+    length += fread(data + length, 1, capacity - length - 1, in);
+    if (length < capacity - 1) {
+      break;
+    }
+    capacity *= 2;
+    uint8_t *more = realloc(data, capacity);
+    if (more == NULL) {
+      free(data);
+    }
+    data = more;
+  }
+  int failed = data == NULL || ferror(in);
+  fclose(in);
+  if (failed) {
+    free(data);
+    return -1;
+  }
+
+  // A tape starts with blank tape and a block header; a listing is text.
+  size_t i = 0;
+  while (i < length && data[i] == 0) {
+    i++;
+  }
+  int result;
+  if (length - i >= 2 && data[i] == 1 && data[i + 1] == 0) {
+    result = pidp11_image_parse_tape(image, data, length);
+  } else {
+    data[length] = '\0';
+    result = pidp11_image_parse_listing(image, (const char *)data, error_line);
+  }
+  free(data);
+  return result;
+}
+
+size_t pidp11_image_words(const pidp11_image_t *image) {
+  size_t words = 0;
+  for (size_t i = 0; i < image->n_runs; i++) {
+    words += image->runs[i].n_words;
+  }
+  return words;
+}
+
+int pidp11_image_fill(pidp11_image_t *image, pidp11_image_examine_t examine,
+                      void *context) {
+  for (size_t i = 0; i < image->n_runs; i++) {
+    pidp11_load_run_t *run = &image->runs[i];
+    for (size_t j = 0; j < run->n_words; j++) {
+      if (run->masks[j] == 3) {
+        continue;
+      }
+      uint16_t value;
+      if (examine(context, run->address + 2 * j, &value)) {
+        return -1;
+      }
+      uint16_t keep = (run->masks[j] & 1 ? 0 : 0x00ff) |
+                      (run->masks[j] & 2 ? 0 : 0xff00);
+      run->words[j] = (run->words[j] & ~keep) | (value & keep);
+      run->masks[j] = 3;
+    }
+  }
+  return 0;
+}
+
+int pidp11_image_write_script(const pidp11_image_t *image, FILE *out) {
+  for (size_t i = 0; i < image->n_runs; i++) {
+    const pidp11_load_run_t *run = &image->runs[i];
+    for (size_t j = 0; j < run->n_words; j++) {
+      fprintf(out, "deposit %o %o\n", (unsigned int)(run->address + 2 * j),
+              run->words[j]);
+    }
+  }
+  return ferror(out) ? -1 : 0;
+}
+
+size_t pidp11_image_check_run(const pidp11_load_run_t *run,
+                              const char *response, FILE *report) {
+  uint8_t *seen = calloc(run->n_words ? run->n_words : 1, 1);
+  if (seen == NULL) {
+    return run->n_words;
+  }
+
+  size_t bad = 0;
+  for (const char *p = response; p != NULL && *p; p = strchr(p, '\n')) {
+    while (*p == '\n' || *p == '\r' || *p == ' ') {
+      p++;
+    }
+    char *end;
+    unsigned long address = strtoul(p, &end, 8);
+    if (end == p || *end != ':') {
+      continue; // not an examine line, such as the prompt.
+    }
+    p = end + 1;
+    unsigned long value = strtoul(p, &end, 8);
+    if (end == p || address < run->address || (address & 1) ||
+        address >= run->address + 2 * run->n_words) {
+      continue;
+    }
+    size_t j = (address - run->address) / 2;
+    uint16_t mask = (run->masks[j] & 1 ? 0x00ff : 0) |
+                    (run->masks[j] & 2 ? 0xff00 : 0);
+    seen[j] = 1;
+    if ((value ^ run->words[j]) & mask) {
+      bad++;
+      if (report != NULL) {
+        fprintf(report, "%lo: expected %06o, read %06lo\n", address,
+                run->words[j], value);
+      }
+    }
+  }
+  for (size_t j = 0; j < run->n_words; j++) {
+    if (!seen[j]) {
+      bad++;
+      if (report != NULL) {
+        fprintf(report, "%o: expected %06o, not read\n",
+                (unsigned int)(run->address + 2 * j), run->words[j]);
+      }
+    }
+  }
+  free(seen);
+  return bad;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PIDP11_LOADER_H
+#define PIDP11_LOADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Programs to load into the simulator's memory, from DEC absolute loader
+ * tapes (.lda or .bin) or octal listings, such as the one in notes.md. The
+ * program is kept as runs of consecutive words, so it can be deposited as a
+ * script of deposits that SimH runs in one round trip, and checked with one
+ * range examine per run.
+ */
+
+typedef struct _pidp11_load_run_t {
+  // The address of the first word, which is even.
+  uint32_t address;
+  size_t n_words;
+  size_t capacity;
+  uint16_t *words;
+  // The bytes of each word that the program sets: bit 0 for the low byte,
+  // bit 1 for the high byte. Absolute loader tapes can set single bytes.
+  uint8_t *masks;
+} pidp11_load_run_t;
+
+typedef struct _pidp11_image_t {
+  size_t n_runs;
+  size_t capacity;
+  pidp11_load_run_t *runs;
+  // The run the last byte went into, as tapes load in order.
+  size_t last;
+  // Whether the program has a start address, and the address.
+  int has_start;
+  uint32_t start;
+} pidp11_image_t;
+
+/**
+ * Read the current value of a word of memory.
+ *
+ * @param[in] context The caller's context.
+ * @param[in] address The word address.
+ * @param[out] value The value.
+ * @return zero on success.
+ */
+typedef int (*pidp11_image_examine_t)(void *context, uint32_t address,
+                                      uint16_t *value);
+
+/**
+ * Set up an empty program.
+ *
+ * @param[out] image The program data structure.
+ */
+void pidp11_image_init(pidp11_image_t *image);
+
+/**
+ * Free a program's runs.
+ *
+ * @param[in] image The program data structure.
+ */
+void pidp11_image_free(pidp11_image_t *image);
+
+/**
+ * Add a byte to a program. A later byte for the same address replaces the
+ * earlier one.
+ *
+ * @param[in] image The program data structure.
+ * @param[in] address The byte address.
+ * @param[in] value The byte.
+ * @return zero on success.
+ */
+int pidp11_image_put_byte(pidp11_image_t *image, uint32_t address,
+                          uint8_t value);
+
+/**
+ * Add a word to a program.
+ *
+ * @param[in] image The program data structure.
+ * @param[in] address The word address, which must be even.
+ * @param[in] value The word.
+ * @return zero on success.
+ */
+int pidp11_image_put_word(pidp11_image_t *image, uint32_t address,
+                          uint16_t value);
+
+/**
+ * Add the blocks of an absolute loader tape to a program. Leading blank
+ * tape is skipped. The tape ends at a block with no data, whose address is
+ * the start address, if it is even.
+ *
+ * @param[in] image The program data structure.
+ * @param[in] tape The tape.
+ * @param[in] length The length of the tape, in bytes.
+ * @return zero on success, or -1 if a block is short or fails its checksum.
+ */
+int pidp11_image_parse_tape(pidp11_image_t *image, const uint8_t *tape,
+                            size_t length);
+
+/**
+ * Add the words of an octal listing to a program. A line starts with an
+ * address and a colon or slash, or carries on from the last word of the
+ * line before, and then has one or more octal words. Anything after the
+ * words, such as the instruction, is ignored, as are lines with no words.
+ *
+ * @param[in] image The program data structure.
+ * @param[in] text The listing, NUL terminated.
+ * @param[out] error_line The line number of a bad line, or NULL.
+ * @return zero on success, or -1 for a bad address or word.
+ */
+int pidp11_image_parse_listing(pidp11_image_t *image, const char *text,
+                               int *error_line);
+
+/**
+ * Read a program from a file, either an absolute loader tape or an octal
+ * listing, telling them apart by their contents.
+ *
+ * @param[in] image The program data structure.
+ * @param[in] path The path to the file.
+ * @param[out] error_line The line number of a bad listing line, zero for
+ *                        other errors, or NULL.
+ * @return zero on success.
+ */
+int pidp11_image_read(pidp11_image_t *image, const char *path,
+                      int *error_line);
+
+/**
+ * Get the number of words in a program.
+ *
+ * @param[in] image The program data structure.
+ * @return the number of words, including words with only one byte set.
+ */
+size_t pidp11_image_words(const pidp11_image_t *image);
+
+/**
+ * Fill in the bytes of the words that the program only sets one byte of,
+ * from the current memory, as SimH deposits whole words.
+ *
+ * @param[in] image The program data structure.
+ * @param[in] examine Reads the current memory.
+ * @param[in] context The context for examine.
+ * @return zero on success.
+ */
+int pidp11_image_fill(pidp11_image_t *image, pidp11_image_examine_t examine,
+                      void *context);
+
+/**
+ * Write a SimH script that deposits a program, one word per line.
+ *
+ * @param[in] image The program data structure.
+ * @param[in] out The stream to write the script to.
+ * @return zero on success.
+ */
+int pidp11_image_write_script(const pidp11_image_t *image, FILE *out);
+
+/**
+ * Check a run against SimH's output for an examine of the run's range,
+ * which has a line of the form "address:<tab>value" for each word. Only
+ * the bytes that the program sets are compared.
+ *
+ * @param[in] run The run.
+ * @param[in] response The examine output, NUL terminated.
+ * @param[in] report The stream to report mismatches on, or NULL.
+ * @return the number of words that differ or are missing.
+ */
+size_t pidp11_image_check_run(const pidp11_load_run_t *run,
+                              const char *response, FILE *report);
+#endif
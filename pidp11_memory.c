@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pidp11_memory.h"
+
+// The bytes in a cache line.
+static const uint32_t line_bytes = 2 * PIDP11_MEMORY_LINE_WORDS;
+
+// The start of the I/O page in the 22-bit physical address space.
+static const uint32_t io_page = 017760000;
+
+// The console addresses of the general registers, in 16, 18 and 22 bits.
+static const uint32_t register_bases[] = {0177700, 0777700, 017777700};
+
+static const char *register_names[PIDP11_MEMORY_REGISTERS] = {
+    "R00", "R01", "R02", "R03", "R04", "R05", "KSP", "PC",
+    "R10", "R11", "R12", "R13", "R14", "R15", "SSP", "USP"};
+
+void pidp11_memory_init(pidp11_memory_t *memory, pidp11_memory_fetch_t fetch,
+                        pidp11_memory_store_t store,
+                        pidp11_memory_set_register_t set_register,
+                        void *context) {
+  memset(memory, 0, sizeof *memory);
+  memory->fetch = fetch;
+  memory->store = store;
+  memory->set_register = set_register;
+  memory->context = context;
+}
+
+int pidp11_memory_register(uint32_t address) {
+  for (size_t i = 0; i < sizeof register_bases / sizeof register_bases[0];
+       i++) {
+    if ((address & ~(uint32_t)(PIDP11_MEMORY_REGISTERS - 1)) ==
+        register_bases[i]) {
+      return address & (PIDP11_MEMORY_REGISTERS - 1);
+    }
+  }
+  return -1;
+}
+
+const char *pidp11_memory_register_name(int index) {
+  return register_names[index];
+}
+
+static pidp11_memory_line_t *find_line(pidp11_memory_t *memory,
+                                       uint32_t address) {
+  return &memory->lines[(address / line_bytes) % PIDP11_MEMORY_LINES];
+}
+
+int pidp11_memory_examine(pidp11_memory_t *memory, uint32_t address,
+                          uint16_t *value) {
+  int index = pidp11_memory_register(address);
+  if (index >= 0) {
+    if (memory->registers[index] == NULL) {
+      return -1;
+    }
+    *value = *memory->registers[index];
+    return 0;
+  }
+  if (address >= io_page) {
+    return memory->fetch(memory->context, address, 1, value);
+  }
+
+  pidp11_memory_line_t *line = find_line(memory, address);
+  uint32_t base = address & ~(line_bytes - 1);
+  if (line->valid && line->address == base) {
+    memory->hits++;
+  } else {
+    memory->fetches++;
+    line->valid = 0;
+    if (memory->fetch(memory->context, base, PIDP11_MEMORY_LINE_WORDS,
+                      line->words)) {
+      // The line runs past the end of memory, so just read the word.
+      return memory->fetch(memory->context, address, 1, value);
+    }
+    line->valid = 1;
+    line->address = base;
+  }
+  *value = line->words[(address - base) / 2];
+  return 0;
+}
+
+int pidp11_memory_deposit(pidp11_memory_t *memory, uint32_t address,
+                          uint16_t value) {
+  int index = pidp11_memory_register(address);
+  if (index >= 0) {
+    if (memory->registers[index] == NULL ||
+        memory->set_register(memory->context, register_names[index], value)) {
+      return -1;
+    }
+    *memory->registers[index] = value;
+    return 0;
+  }
+
+  // Only the line holding the word is touched; the slot may hold another.
+  pidp11_memory_line_t *line = find_line(memory, address);
+  uint32_t base = address & ~(line_bytes - 1);
+  int cached = line->valid && line->address == base;
+  if (memory->store(memory->context, address, value)) {
+    if (cached) {
+      line->valid = 0;
+    }
+    return -1;
+  }
+  if (cached) {
+    line->words[(address - base) / 2] = value;
+  }
+  return 0;
+}
+
+void pidp11_memory_invalidate(pidp11_memory_t *memory) {
+  for (int i = 0; i < PIDP11_MEMORY_LINES; i++) {
+    memory->lines[i].valid = 0;
+  }
+}
+
+size_t pidp11_memory_parse(const char *response, uint32_t address,
+                           size_t n_words, uint16_t *words) {
+  size_t found = 0;
+  for (const char *p = response; p != NULL && *p; p = strchr(p, '\n')) {
+    char *end;
+    unsigned long word_address = strtoul(p, &end, 8);
+    if (end == p || *end != ':') {
+      p++;
+      continue; // not an examine line, such as the prompt.
+    }
+    p = end + 1;
+    unsigned long value = strtoul(p, &end, 8);
+    if (end == p || word_address < address || (word_address & 1) ||
+        word_address >= address + 2 * n_words) {
+      continue;
+    }
+    words[(word_address - address) / 2] = value;
+    found++;
+  }
+  return found;
+}
+
+void pidp11_memory_print(const pidp11_memory_t *memory, FILE *out) {
+  if (memory->hits + memory->fetches == 0) {
+    return;
+  }
+  fprintf(out,
+          "PiDP11: memory: %llu examines from the cache, %llu line fetches\n",
+          (unsigned long long)memory->hits,
+          (unsigned long long)memory->fetches);
+}
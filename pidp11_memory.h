@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PIDP11_MEMORY_H
+#define PIDP11_MEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Memory as the console's EXAM and DEP see it. While the CPU is halted,
+ * memory only changes through deposits, so recently examined words are
+ * kept in a small cache of lines, each fetched with one range examine:
+ * stepping through memory with EXAM costs one round trip per line rather
+ * than one per word. The I/O page is not cached, as device registers
+ * change on their own. The addresses 17777700-17777717, and their 16 and
+ * 18-bit forms 177700-177717 and 777700-777717, are the general registers,
+ * as on the 11/70 console, and are read from a block of registers that the
+ * panel samples.
+ */
+
+#define PIDP11_MEMORY_LINE_WORDS 8
+#define PIDP11_MEMORY_LINES 16
+#define PIDP11_MEMORY_REGISTERS 16
+
+/**
+ * Read consecutive words of memory.
+ *
+ * @param[in] context The caller's context.
+ * @param[in] address The address of the first word.
+ * @param[in] n_words The number of words.
+ * @param[out] words The words.
+ * @return zero on success.
+ */
+typedef int (*pidp11_memory_fetch_t)(void *context, uint32_t address,
+                                     size_t n_words, uint16_t *words);
+
+/**
+ * Write a word of memory.
+ *
+ * @param[in] context The caller's context.
+ * @param[in] address The word address.
+ * @param[in] value The word.
+ * @return zero on success.
+ */
+typedef int (*pidp11_memory_store_t)(void *context, uint32_t address,
+                                     uint16_t value);
+
+/**
+ * Write a register.
+ *
+ * @param[in] context The caller's context.
+ * @param[in] name The SimH register name.
+ * @param[in] value The value.
+ * @return zero on success.
+ */
+typedef int (*pidp11_memory_set_register_t)(void *context, const char *name,
+                                            uint16_t value);
+
+typedef struct _pidp11_memory_line_t {
+  int valid;
+  uint32_t address;
+  uint16_t words[PIDP11_MEMORY_LINE_WORDS];
+} pidp11_memory_line_t;
+
+typedef struct _pidp11_memory_t {
+  pidp11_memory_fetch_t fetch;
+  pidp11_memory_store_t store;
+  pidp11_memory_set_register_t set_register;
+  void *context;
+
+  // Direct mapped by address.
+  pidp11_memory_line_t lines[PIDP11_MEMORY_LINES];
+
+  // Where the panel samples each general register into, in console address
+  // order, or NULL. They are only read while the CPU is halted.
+  uint16_t *registers[PIDP11_MEMORY_REGISTERS];
+
+  // Examines served from the cache, and line fetches.
+  uint64_t hits;
+  uint64_t fetches;
+} pidp11_memory_t;
+
+/**
+ * Set up a memory with an empty cache.
+ *
+ * @param[out] memory The memory data structure.
+ * @param[in] fetch Reads memory.
+ * @param[in] store Writes memory.
+ * @param[in] set_register Writes a general register.
+ * @param[in] context The context for the callbacks.
+ */
+void pidp11_memory_init(pidp11_memory_t *memory, pidp11_memory_fetch_t fetch,
+                        pidp11_memory_store_t store,
+                        pidp11_memory_set_register_t set_register,
+                        void *context);
+
+/**
+ * Get the general register a console address maps to.
+ *
+ * @param[in] address The address.
+ * @return the index into registers, or -1 for a memory address.
+ */
+int pidp11_memory_register(uint32_t address);
+
+/**
+ * Get the SimH name of a general register: R00-R05, KSP and PC, then
+ * R10-R15, SSP and USP.
+ *
+ * @param[in] index The index into registers.
+ * @return the name.
+ */
+const char *pidp11_memory_register_name(int index);
+
+/**
+ * Examine a word of memory or a general register.
+ *
+ * @param[in] memory The memory data structure.
+ * @param[in] address The address.
+ * @param[out] value The word.
+ * @return zero on success.
+ */
+int pidp11_memory_examine(pidp11_memory_t *memory, uint32_t address,
+                          uint16_t *value);
+
+/**
+ * Deposit a word in memory or a general register. A cached word is
+ * written through.
+ *
+ * @param[in] memory The memory data structure.
+ * @param[in] address The address.
+ * @param[in] value The word.
+ * @return zero on success.
+ */
+int pidp11_memory_deposit(pidp11_memory_t *memory, uint32_t address,
+                          uint16_t value);
+
+/**
+ * Forget the cached words, as the CPU is about to run, or memory may have
+ * changed some other way.
+ *
+ * @param[in] memory The memory data structure.
+ */
+void pidp11_memory_invalidate(pidp11_memory_t *memory);
+
+/**
+ * Read SimH's output for an examine of a range, which has a line of the
+ * form "address:<tab>value" for each word.
+ *
+ * @param[in] response The examine output, NUL terminated.
+ * @param[in] address The address of the first word.
+ * @param[in] n_words The number of words.
+ * @param[out] words The words.
+ * @return the number of words in the range that the output has.
+ */
+size_t pidp11_memory_parse(const char *response, uint32_t address,
+                           size_t n_words, uint16_t *words);
+
+/**
+ * Print the cache statistics.
+ *
+ * @param[in] memory The memory data structure.
+ * @param[in] out The stream to print to.
+ */
+void pidp11_memory_print(const pidp11_memory_t *memory, FILE *out);
+#endif
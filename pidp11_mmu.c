@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "pidp11_mmu.h"
+
+// MMR0: relocation enabled.
+static const uint16_t mmr0_relocate = 1 << 0;
+
+// MMR3: 22-bit mapping, and D space for the kernel, supervisor and user
+// modes.
+static const uint16_t mmr3_map22 = 1 << 4;
+static const uint16_t mmr3_d_space[PIDP11_MMU_MODES] = {1 << 2, 1 << 1,
+                                                        1 << 0};
+
+// PDR fields: the page length, in blocks, expansion downwards, and the
+// 11/70's three-bit access control in bits 2-0. Of its codes, 0 is not
+// resident, and 3 and 7 are unused, so every access aborts; 1 and 2 are
+// read-only, and 4, 5 and 6 read/write. Codes 1, 4 and 5 also trap on some
+// accesses, after they complete, which the console does not take.
+static const int pdr_plf_shift = 8;
+static const uint16_t pdr_ed = 1 << 3;
+static const uint16_t pdr_acf = 7;
+
+// The I/O page: the top 8 KB of each address space.
+static const uint32_t io_page_16 = 0160000;
+static const uint32_t io_page_18 = 0760000;
+static const uint32_t io_page_22 = 017760000;
+
+static const char mode_letters[PIDP11_MMU_MODES] = {'K', 'S', 'U'};
+static const char space_letters[PIDP11_MMU_SPACES] = {'I', 'D'};
+
+void pidp11_mmu_init(pidp11_mmu_t *mmu) { memset(mmu, 0, sizeof *mmu); }
+
+void pidp11_mmu_register_name(pidp11_mmu_mode_t mode, pidp11_mmu_space_t space,
+                              int page, int pdr, char *name, size_t size) {
+  snprintf(name, size, "%c%c%s%d", mode_letters[mode], space_letters[space],
+           pdr ? "PDR" : "PAR", page);
+}
+
+pidp11_mmu_mode_t pidp11_mmu_psw_mode(uint16_t psw) {
+  switch (psw >> 14) {
+  case 0:
+    return MMU_KERNEL;
+  case 1:
+    return MMU_SUPER;
+  default:
+    return MMU_USER; // 2 is reserved, and maps as user mode.
+  }
+}
+
+static void pidp11_mmu_build(pidp11_mmu_t *mmu) {
+  memcpy(mmu->built_par, mmu->par, sizeof mmu->built_par);
+  memcpy(mmu->built_pdr, mmu->pdr, sizeof mmu->built_pdr);
+  mmu->built_mmr0 = mmu->mmr0;
+  mmu->built_mmr3 = mmu->mmr3;
+
+  if (!(mmu->built_mmr0 & mmr0_relocate)) {
+    mmu->length = ADDRESS_16;
+  } else {
+    mmu->length = (mmu->built_mmr3 & mmr3_map22) ? ADDRESS_22 : ADDRESS_18;
+  }
+
+  for (int mode = 0; mode < PIDP11_MMU_MODES; mode++) {
+    for (int space = 0; space < PIDP11_MMU_SPACES; space++) {
+      int registers = (space == MMU_D && (mmu->built_mmr3 & mmr3_d_space[mode]))
+                          ? MMU_D
+                          : MMU_I;
+      for (int i = 0; i < PIDP11_MMU_PAGES; i++) {
+        uint16_t par = mmu->built_par[mode][registers][i];
+        uint16_t pdr = mmu->built_pdr[mode][registers][i];
+        int acf = pdr & pdr_acf;
+        uint8_t plf = (pdr >> pdr_plf_shift) & 0177;
+        pidp11_mmu_page_t *page = &mmu->pages[mode][space][i];
+        page->base = (uint32_t)par << 6;
+        page->resident = acf == 1 || acf == 2 || (acf >= 4 && acf <= 6);
+        page->writable = acf >= 4 && acf <= 6;
+        page->first_block = (pdr & pdr_ed) ? plf : 0;
+        page->last_block = (pdr & pdr_ed) ? 0177 : plf;
+      }
+    }
+  }
+  mmu->version++;
+}
+
+unsigned int pidp11_mmu_refresh(pidp11_mmu_t *mmu) {
+  if (mmu->version == 0 || mmu->mmr0 != mmu->built_mmr0 ||
+      mmu->mmr3 != mmu->built_mmr3 ||
+      memcmp(mmu->par, mmu->built_par, sizeof mmu->par) != 0 ||
+      memcmp(mmu->pdr, mmu->built_pdr, sizeof mmu->pdr) != 0) {
+    pidp11_mmu_build(mmu);
+  }
+  return mmu->version;
+}
+
+int pidp11_mmu_translate(pidp11_mmu_t *mmu, pidp11_mmu_mode_t mode,
+                         pidp11_mmu_space_t space, uint16_t address,
+                         int write, uint32_t *physical) {
+  pidp11_mmu_refresh(mmu);
+  mmu->translations++;
+
+  if (mmu->length == ADDRESS_16) {
+    *physical = address >= io_page_16 ? address - io_page_16 + io_page_22
+                                      : address;
+    return 0;
+  }
+
+  const pidp11_mmu_page_t *page = &mmu->pages[mode][space][address >> 13];
+  uint8_t block = (address >> 6) & 0177;
+  if (!page->resident || (write && !page->writable) ||
+      block < page->first_block ||
+      block > page->last_block) {
+    return -1;
+  }
+  uint32_t result = page->base + (address & 017777);
+  if (mmu->length == ADDRESS_18) {
+    result &= 0777777;
+    if (result >= io_page_18) {
+      result = result - io_page_18 + io_page_22;
+    }
+  } else {
+    result &= 017777777;
+  }
+  *physical = result;
+  return 0;
+}
+
+void pidp11_mmu_print(const pidp11_mmu_t *mmu, FILE *out) {
+  if (mmu->translations == 0) {
+    return;
+  }
+  fprintf(out, "PiDP11: mmu: %llu translations, %u page table builds\n",
+          (unsigned long long)mmu->translations, mmu->version);
+}
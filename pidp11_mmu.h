@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PIDP11_MMU_H
+#define PIDP11_MMU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pidp11.h"
+
+/*
+ * Virtual to physical translation through the 11/70's memory management
+ * unit, done locally from registers the panel samples: the page address
+ * and descriptor registers of each mode and space, MMR0 and MMR3. The
+ * registers are compared with the ones the page table was built from on
+ * each translation, and the table is only rebuilt, and its version
+ * advanced, when they change, so a translation is a table lookup.
+ */
+
+#define PIDP11_MMU_MODES 3
+#define PIDP11_MMU_SPACES 2
+#define PIDP11_MMU_PAGES 8
+
+typedef enum _pidp11_mmu_mode_t {
+  MMU_KERNEL,
+  MMU_SUPER,
+  MMU_USER
+} pidp11_mmu_mode_t;
+
+typedef enum _pidp11_mmu_space_t { MMU_I, MMU_D } pidp11_mmu_space_t;
+
+/**
+ * A page, as built from its registers: the physical address it starts at,
+ * whether it can be read, and written, and the 64-byte blocks in it that can
+ * be.
+ */
+typedef struct _pidp11_mmu_page_t {
+  uint32_t base;
+  char resident;
+  char writable;
+  uint8_t first_block;
+  uint8_t last_block;
+} pidp11_mmu_page_t;
+
+typedef struct _pidp11_mmu_t {
+  // Where the panel samples the registers into.
+  uint16_t par[PIDP11_MMU_MODES][PIDP11_MMU_SPACES][PIDP11_MMU_PAGES];
+  uint16_t pdr[PIDP11_MMU_MODES][PIDP11_MMU_SPACES][PIDP11_MMU_PAGES];
+  uint16_t mmr0;
+  uint16_t mmr3;
+
+  // The registers the pages were built from, and the pages. Each space's
+  // pages are the I space ones when MMR3 does not enable its D space.
+  uint16_t built_par[PIDP11_MMU_MODES][PIDP11_MMU_SPACES][PIDP11_MMU_PAGES];
+  uint16_t built_pdr[PIDP11_MMU_MODES][PIDP11_MMU_SPACES][PIDP11_MMU_PAGES];
+  uint16_t built_mmr0;
+  uint16_t built_mmr3;
+  pidp11_mmu_page_t pages[PIDP11_MMU_MODES][PIDP11_MMU_SPACES]
+                         [PIDP11_MMU_PAGES];
+  addressing_length_t length;
+
+  // The number of times the pages were built, zero until they first are,
+  // and the translations made.
+  unsigned int version;
+  uint64_t translations;
+} pidp11_mmu_t;
+
+/**
+ * Set up an MMU with the registers all zero, and no pages built.
+ *
+ * @param[out] mmu The MMU data structure.
+ */
+void pidp11_mmu_init(pidp11_mmu_t *mmu);
+
+/**
+ * Get the SimH name of a page register, such as KIPAR0 or UDPDR7.
+ *
+ * @param[in] mode The mode.
+ * @param[in] space The space.
+ * @param[in] page The page, 0 to 7.
+ * @param[in] pdr Whether to name the descriptor rather than the address
+ *                register.
+ * @param[out] name The name.
+ * @param[in] size The size of name.
+ */
+void pidp11_mmu_register_name(pidp11_mmu_mode_t mode, pidp11_mmu_space_t space,
+                              int page, int pdr, char *name, size_t size);
+
+/**
+ * Get the mode the CPU runs in from the PSW.
+ *
+ * @param[in] psw The PSW.
+ * @return the current mode.
+ */
+pidp11_mmu_mode_t pidp11_mmu_psw_mode(uint16_t psw);
+
+/**
+ * Rebuild the pages if the registers changed since they were built.
+ * Translations do this themselves.
+ *
+ * @param[in] mmu The MMU data structure.
+ * @return the version of the pages.
+ */
+unsigned int pidp11_mmu_refresh(pidp11_mmu_t *mmu);
+
+/**
+ * Translate a virtual address to a 22-bit physical address, with 16, 18 or
+ * 22-bit addressing as MMR0 and MMR3 select. The top 8 KB of the 16 and
+ * 18-bit address spaces is the I/O page.
+ *
+ * @param[in] mmu The MMU data structure.
+ * @param[in] mode The mode.
+ * @param[in] space The space.
+ * @param[in] address The virtual address.
+ * @param[in] write Whether the access is a write.
+ * @param[out] physical The physical address.
+ * @return zero on success, or -1 if the access would abort.
+ */
+int pidp11_mmu_translate(pidp11_mmu_t *mmu, pidp11_mmu_mode_t mode,
+                         pidp11_mmu_space_t space, uint16_t address,
+                         int write, uint32_t *physical);
+
+/**
+ * Print the translation statistics.
+ *
+ * @param[in] mmu The MMU data structure.
+ * @param[in] out The stream to print to.
+ */
+void pidp11_mmu_print(const pidp11_mmu_t *mmu, FILE *out);
+#endif
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "pidp11_telemetry.h"
+
+static const char *rate_names[] = {"full", "idle", "blank"};
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static double seconds(int64_t ns) { return ns / 1e9; }
+
+static void write_header(FILE *out, const char *name, const char *type,
+                         const char *help) {
+  fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void pidp11_telemetry_write(const pidp11_stats_t *stats, FILE *out) {
+  write_header(out, "pidp11_frames_total", "counter", "Frames refreshed.");
+  fprintf(out, "pidp11_frames_total %llu\n",
+          (unsigned long long)stats->frames);
+  write_header(out, "pidp11_frame_overruns_total", "counter",
+               "Frames that ended after the next was due to start.");
+  fprintf(out, "pidp11_frame_overruns_total %llu\n",
+          (unsigned long long)stats->overruns);
+  write_header(out, "pidp11_missed_deadlines_total", "counter",
+               "LED rows lit after they were due to go dark.");
+  fprintf(out, "pidp11_missed_deadlines_total %llu\n",
+          (unsigned long long)stats->missed_deadlines);
+
+  write_header(out, "pidp11_frame_period_seconds", "summary",
+               "Frame period.");
+  fprintf(out, "pidp11_frame_period_seconds_sum %.9f\n",
+          seconds(stats->period_total_ns));
+  fprintf(out, "pidp11_frame_period_seconds_count %llu\n",
+          (unsigned long long)stats->frames);
+
+  write_header(out, "pidp11_frame_jitter_seconds", "summary",
+               "Difference between the frame period and its target.");
+  for (int i = 0; i < sizeof quantiles / sizeof quantiles[0]; i++) {
+    fprintf(out, "pidp11_frame_jitter_seconds{quantile=\"%g\"} %.9f\n",
+            quantiles[i],
+            seconds(pidp11_stats_jitter_percentile(stats, quantiles[i])));
+  }
+  fprintf(out, "pidp11_frame_jitter_seconds_sum %.9f\n",
+          seconds(stats->total_error_ns));
+  fprintf(out, "pidp11_frame_jitter_seconds_count %llu\n",
+          (unsigned long long)stats->frames);
+  write_header(out, "pidp11_frame_jitter_max_seconds", "gauge",
+               "Largest difference between a frame period and its target.");
+  fprintf(out, "pidp11_frame_jitter_max_seconds %.9f\n",
+          seconds(stats->max_error_ns));
+
+  write_header(out, "pidp11_row_dwell_seconds", "summary",
+               "Time each LED row is lit.");
+  for (int i = 0; i < 6; i++) {
+    fprintf(out, "pidp11_row_dwell_seconds_sum{row=\"%d\"} %.9f\n", i,
+            seconds(stats->row_total_ns[i]));
+    fprintf(out, "pidp11_row_dwell_seconds_count{row=\"%d\"} %llu\n", i,
+            (unsigned long long)stats->row_count[i]);
+  }
+  write_header(out, "pidp11_row_dwell_max_seconds", "gauge",
+               "Longest time an LED row was lit.");
+  for (int i = 0; i < 6; i++) {
+    fprintf(out, "pidp11_row_dwell_max_seconds{row=\"%d\"} %.9f\n", i,
+            seconds(stats->row_max_ns[i]));
+  }
+
+  write_header(out, "pidp11_switch_phase_seconds", "summary",
+               "Time spent reading the switches each frame.");
+  fprintf(out, "pidp11_switch_phase_seconds_sum %.9f\n",
+          seconds(stats->switch_total_ns));
+  fprintf(out, "pidp11_switch_phase_seconds_count %llu\n",
+          (unsigned long long)stats->switch_count);
+  write_header(out, "pidp11_switch_phase_max_seconds", "gauge",
+               "Longest time spent reading the switches in a frame.");
+  fprintf(out, "pidp11_switch_phase_max_seconds %.9f\n",
+          seconds(stats->switch_max_ns));
+
+  write_header(out, "pidp11_rate_frames_total", "counter",
+               "Frames refreshed at each refresh rate.");
+  for (int i = 0; i < PIDP11_N_RATES; i++) {
+    fprintf(out, "pidp11_rate_frames_total{rate=\"%s\"} %llu\n",
+            rate_names[i], (unsigned long long)stats->rate_frames[i]);
+  }
+  write_header(out, "pidp11_rate_seconds_total", "counter",
+               "Time spent at each refresh rate.");
+  for (int i = 0; i < PIDP11_N_RATES; i++) {
+    fprintf(out, "pidp11_rate_seconds_total{rate=\"%s\"} %.9f\n",
+            rate_names[i], seconds(stats->rate_wall_ns[i]));
+  }
+  write_header(out, "pidp11_rate_cpu_seconds_total", "counter",
+               "Refresh thread CPU time at each refresh rate.");
+  for (int i = 0; i < PIDP11_N_RATES; i++) {
+    fprintf(out, "pidp11_rate_cpu_seconds_total{rate=\"%s\"} %.9f\n",
+            rate_names[i], seconds(stats->rate_cpu_ns[i]));
+  }
+}
+
+static void *telemetry_thread(void *context) {
+  pidp11_telemetry_t *telemetry = (pidp11_telemetry_t *)context;
+  pidp11_stats_t stats;
+
+  while (1) {
+    int client = accept(telemetry->fd, NULL, NULL);
+    if (client < 0) {
+      continue;
+    }
+    // Finish the reply before stopping, so the stream is not left open.
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    FILE *out = fdopen(client, "w");
+    if (out != NULL) {
+      pidp11_get_stats(telemetry->pidp11, &stats);
+      pidp11_telemetry_write(&stats, out);
+      fclose(out);
+    } else {
+      close(client);
+    }
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+  }
+  return NULL;
+}
+
+int pidp11_telemetry_start(pidp11_telemetry_t *telemetry, pidp11_t *pidp11,
+                           const char *path) {
+  memset(telemetry, 0, sizeof *telemetry);
+  telemetry->pidp11 = pidp11;
+  telemetry->addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof telemetry->addr.sun_path) {
+    return -1;
+  }
+  strcpy(telemetry->addr.sun_path, path);
+
+  telemetry->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (telemetry->fd < 0) {
+    return -1;
+  }
+  unlink(path);
+  if (bind(telemetry->fd, (struct sockaddr *)&telemetry->addr,
+           sizeof telemetry->addr) ||
+      listen(telemetry->fd, 4) ||
+      pthread_create(&telemetry->thread, NULL, telemetry_thread, telemetry)) {
+    close(telemetry->fd);
+    return -1;
+  }
+  return 0;
+}
+
+int pidp11_telemetry_stop(pidp11_telemetry_t *telemetry) {
+  pthread_cancel(telemetry->thread);
+  pthread_join(telemetry->thread, NULL);
+  close(telemetry->fd);
+  return unlink(telemetry->addr.sun_path);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2024 Joseph Vigneau
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PIDP11_TELEMETRY_H
+#define PIDP11_TELEMETRY_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/un.h>
+
+#include "pidp11.h"
+
+/*
+ * Export the refresh loop statistics over a Unix domain socket. Each
+ * connection gets a snapshot in the Prometheus text exposition format, and
+ * is closed, so the socket can be read with, for example:
+ *
+ *   socat - UNIX-CONNECT:/run/pidp11.sock
+ */
+
+typedef struct _pidp11_telemetry_t {
+  pidp11_t *pidp11;
+  struct sockaddr_un addr;
+  int fd;
+  pthread_t thread;
+} pidp11_telemetry_t;
+
+/**
+ * Write a statistics snapshot in the Prometheus text exposition format.
+ *
+ * @param[in] stats The statistics.
+ * @param[in] out The stream to write to.
+ */
+void pidp11_telemetry_write(const pidp11_stats_t *stats, FILE *out);
+
+/**
+ * Listen on a Unix domain socket, replacing any socket already at the path,
+ * and serve statistics snapshots from a thread.
+ *
+ * @param[out] telemetry The telemetry data structure.
+ * @param[in] pidp11 The PiDP11 data structure.
+ * @param[in] path The socket path.
+ * @return zero on success.
+ */
+int pidp11_telemetry_start(pidp11_telemetry_t *telemetry, pidp11_t *pidp11,
+                           const char *path);
+
+/**
+ * Stop serving statistics, and remove the socket.
+ *
+ * @param[in] telemetry The telemetry data structure.
+ * @return zero on success.
+ */
+int pidp11_telemetry_stop(pidp11_telemetry_t *telemetry);
+#endif
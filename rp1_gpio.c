@@ -23,31 +23,194 @@
 #include "rp1_gpio.h"
 #include <stddef.h>
 
+static const uint64_t RP1_INVALID_PINS = 0xfffffffff0000000;
+
+/**
+ * Map a pin function to a GPIOn_CTRL FUNCSEL value. IN and OUT both select
+ * the RIO function; the direction lives in RIO_OE.
+ */
+static uint32_t rp1_funcsel(pin_function_t value) {
+  switch (value) {
+  case IN:
+  case OUT:
+    return RP1_FUNCSEL_SYS_RIO;
+  case ALT0:
+    return 0;
+  case ALT1:
+    return 1;
+  case ALT2:
+    return 2;
+  case ALT3:
+    return 3;
+  case ALT4:
+    return 4;
+  case ALT5:
+    return 5;
+  case ALT6:
+    return 6;
+  case ALT7:
+    return 7;
+  }
+  return RP1_CTRL_FUNCSEL; // NULL function.
+}
+
+/**
+ * Write the GPIOn_CTRL and pad registers that differ from the shadows, and
+ * update the shadows.
+ */
+static void rp1_gpio_write_config(rp1_gpio_ext_t *ext, uint64_t pins,
+                                  uint32_t *ctrl, uint32_t *pads) {
+  volatile uint32_t *pad_base = ext->base + RP1_PADS_BANK0 + RP1_PADS_GPIO0;
+
+  for (int pin = 0; pin < RP1_N_PINS; pin++) {
+    if ((pins & ((uint64_t)1 << pin)) == 0) {
+      continue;
+    }
+    if (pads[pin] != ext->pads[pin]) {
+      *(pad_base + pin) = pads[pin];
+      ext->pads[pin] = pads[pin];
+    }
+    if (ctrl[pin] != ext->ctrl[pin]) {
+      *(ext->base + RP1_GPIO0_CTRL + (pin * 2)) = ctrl[pin];
+      ext->ctrl[pin] = ctrl[pin];
+    }
+  }
+}
+
 int rp1_gpio_close(gpio_t *gpio) { return GPIO_SUCCESS; }
 
+int rp1_gpio_set_function_bits(gpio_t *gpio, uint64_t pins,
+                               pin_function_t value) {
+  rp1_gpio_ext_t *ext = (rp1_gpio_ext_t *)gpio->ext;
+  volatile uint32_t *rio = ext->base + RP1_RIO0;
+  uint32_t ctrl[28];
+  uint32_t pads[28];
+
+  if ((pins & RP1_INVALID_PINS) != 0) {
+    return GPIO_ERR_INVALID_PIN; // Bank 0 has 28 GPIO pins.
+  }
+
+  // Stop driving inputs before they are handed to RIO.
+  uint32_t oe_clear = (value == IN) ? (ext->oe & pins) : 0;
+  if (oe_clear != 0) {
+    *(rio + RP1_ATOMIC_CLR + RP1_RIO_OE) = oe_clear;
+    ext->oe &= ~oe_clear;
+  }
+
+  uint32_t funcsel = rp1_funcsel(value);
+  for (int pin = 0; pin < RP1_N_PINS; pin++) {
+    ctrl[pin] = (ext->ctrl[pin] & ~RP1_CTRL_FUNCSEL) | funcsel;
+    pads[pin] = (ext->pads[pin] & ~RP1_PAD_OD) | RP1_PAD_IE;
+  }
+  rp1_gpio_write_config(ext, pins, ctrl, pads);
+
+  uint32_t oe_set = (value == OUT) ? (~ext->oe & pins) : 0;
+  if (oe_set != 0) {
+    *(rio + RP1_ATOMIC_SET + RP1_RIO_OE) = oe_set;
+    ext->oe |= oe_set;
+  }
+
+  return GPIO_SUCCESS;
+}
+
 int rp1_gpio_set_function_pins(gpio_t *gpio, pin_t *pins, size_t n,
                                pin_function_t value) {
-  return -1;
+  for (int i = 0; i < n; i++) {
+    if (pins[i] >= RP1_N_PINS) {
+      return GPIO_ERR_INVALID_PIN;
+    }
+  }
+  return rp1_gpio_set_function_bits(gpio, pins_to_bits(pins, n), value);
+}
+
+int rp1_gpio_set_pull_bits(gpio_t *gpio, uint64_t pins, pull_control_t value) {
+  rp1_gpio_ext_t *ext = (rp1_gpio_ext_t *)gpio->ext;
+  uint32_t pads[28];
+
+  if ((pins & RP1_INVALID_PINS) != 0) {
+    return GPIO_ERR_INVALID_PIN;
+  }
+
+  uint32_t pull = 0;
+  if (value == UP) {
+    pull = RP1_PAD_PUE;
+  } else if (value == DOWN) {
+    pull = RP1_PAD_PDE;
+  }
+  for (int pin = 0; pin < RP1_N_PINS; pin++) {
+    pads[pin] = (ext->pads[pin] & ~(RP1_PAD_PUE | RP1_PAD_PDE)) | pull;
+  }
+  rp1_gpio_write_config(ext, pins, ext->ctrl, pads);
+
+  return GPIO_SUCCESS;
 }
 
 int rp1_gpio_set_pull_pins(gpio_t *gpio, pin_t *pins, size_t n,
                            pull_control_t value) {
-  return -1;
+  for (int i = 0; i < n; i++) {
+    if (pins[i] >= RP1_N_PINS) {
+      return GPIO_ERR_INVALID_PIN;
+    }
+  }
+  return rp1_gpio_set_pull_bits(gpio, pins_to_bits(pins, n), value);
+}
+
+int rp1_gpio_set_bits(gpio_t *gpio, uint64_t pins, char value) {
+  volatile uint32_t *rio = ((rp1_gpio_ext_t *)gpio->ext)->base + RP1_RIO0;
+
+  if ((pins & RP1_INVALID_PINS) != 0) {
+    return GPIO_ERR_INVALID_PIN;
+  }
+  if (value == 0) {
+    *(rio + RP1_ATOMIC_CLR + RP1_RIO_OUT) = pins;
+  } else {
+    *(rio + RP1_ATOMIC_SET + RP1_RIO_OUT) = pins;
+  }
+
+  return GPIO_SUCCESS;
 }
 
 int rp1_gpio_set_pins(gpio_t *gpio, pin_t *pins, size_t n, char value) {
-  return -1;
+  for (int i = 0; i < n; i++) {
+    if (pins[i] >= RP1_N_PINS) {
+      return GPIO_ERR_INVALID_PIN;
+    }
+  }
+  return rp1_gpio_set_bits(gpio, pins_to_bits(pins, n), value);
+}
+
+int rp1_gpio_write_masked(gpio_t *gpio, uint64_t set_pins,
+                          uint64_t clear_pins) {
+  volatile uint32_t *rio = ((rp1_gpio_ext_t *)gpio->ext)->base + RP1_RIO0;
+
+  if (((set_pins | clear_pins) & RP1_INVALID_PINS) != 0) {
+    return GPIO_ERR_INVALID_PIN; // Bank 0 has 28 GPIO pins.
+  }
+  if (set_pins != 0) {
+    *(rio + RP1_ATOMIC_SET + RP1_RIO_OUT) = set_pins;
+  }
+  if (clear_pins != 0) {
+    *(rio + RP1_ATOMIC_CLR + RP1_RIO_OUT) = clear_pins;
+  }
+
+  return GPIO_SUCCESS;
+}
+
+int rp1_gpio_get_bits(gpio_t *gpio, uint64_t *values) {
+  volatile uint32_t *rio = ((rp1_gpio_ext_t *)gpio->ext)->base + RP1_RIO0;
+  *values = *(rio + RP1_RIO_SYNC_IN) & ~RP1_INVALID_PINS;
+  return GPIO_SUCCESS;
 }
 
 int rp1_gpio_get_pins(gpio_t *gpio, pin_t *pins, char *values, size_t n) {
-  volatile uint32_t *base = ((rp1_gpio_ext_t *)gpio->ext)->base;
+  uint64_t bits;
 
+  rp1_gpio_get_bits(gpio, &bits);
   for (int i = 0; i < n; i++) {
-    if (pins[i] < 28) {
-      if (*(base + RP1_GPIO0_STATUS + (i * 2)) & (1 << 23)) {
-        values[i] = -1;
-      }
+    if (pins[i] >= RP1_N_PINS) {
+      return GPIO_ERR_INVALID_PIN;
     }
+    values[i] = (bits & ((uint64_t)1 << pins[i])) ? -1 : 0; // all ones.
   }
 
   return GPIO_SUCCESS;
@@ -58,11 +221,23 @@ int rp1_gpio_init(gpio_t *gpio, rp1_gpio_ext_t *ext) {
     return -1; // TODO: better error return value.
   }
 
+  volatile uint32_t *pad_base = ext->base + RP1_PADS_BANK0 + RP1_PADS_GPIO0;
+  for (int pin = 0; pin < RP1_N_PINS; pin++) {
+    ext->ctrl[pin] = *(ext->base + RP1_GPIO0_CTRL + (pin * 2));
+    ext->pads[pin] = *(pad_base + pin);
+  }
+  ext->oe = *(ext->base + RP1_RIO0 + RP1_RIO_OE);
+
   gpio->close = rp1_gpio_close;
   gpio->set_function_pins = rp1_gpio_set_function_pins;
+  gpio->set_function_bits = rp1_gpio_set_function_bits;
   gpio->set_pull_pins = rp1_gpio_set_pull_pins;
+  gpio->set_pull_bits = rp1_gpio_set_pull_bits;
   gpio->set_pins = rp1_gpio_set_pins;
+  gpio->set_bits = rp1_gpio_set_bits;
+  gpio->write_masked = rp1_gpio_write_masked;
   gpio->get_pins = rp1_gpio_get_pins;
+  gpio->get_bits = rp1_gpio_get_bits;
 
   gpio->ext = ext;
 
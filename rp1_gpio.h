@@ -25,6 +25,7 @@
 
 #include "gpio.h"
 #include <stddef.h>
+#include <stdint.h>
 
 // clang-format off
 static const int RP1_GPIO0_STATUS  = 0x000 >> 2;
@@ -95,15 +96,60 @@ static const int RP1_PCIE_INTF     = 0x120 >> 2;
 static const int RP1_PCIE_INTS     = 0x124 >> 2;
 // clang-format on
 
+// clang-format off
+/* The offset of the RIO block from IO_BANK0, and the RIO registers. */
+static const int RP1_RIO0          = 0x10000 >> 2;
+static const int RP1_RIO_OUT       = 0x000 >> 2;
+static const int RP1_RIO_OE        = 0x004 >> 2;
+static const int RP1_RIO_NOSYNC_IN = 0x008 >> 2;
+static const int RP1_RIO_SYNC_IN   = 0x00C >> 2;
+
+/* The offset of the PADS block from IO_BANK0, and the PADS registers. */
+static const int RP1_PADS_BANK0          = 0x20000 >> 2;
+static const int RP1_PADS_VOLTAGE_SELECT = 0x000 >> 2;
+static const int RP1_PADS_GPIO0          = 0x004 >> 2;
+
+/* Atomic register access aliases, added to a register offset. */
+static const int RP1_ATOMIC_XOR    = 0x1000 >> 2;
+static const int RP1_ATOMIC_SET    = 0x2000 >> 2;
+static const int RP1_ATOMIC_CLR    = 0x3000 >> 2;
+
+/* GPIOn_CTRL fields. */
+static const uint32_t RP1_CTRL_FUNCSEL      = 0x1f;
+static const uint32_t RP1_FUNCSEL_SYS_RIO   = 5;
+
+/* PADS GPIOn fields. */
+static const uint32_t RP1_PAD_OD  = 1 << 7;
+static const uint32_t RP1_PAD_IE  = 1 << 6;
+static const uint32_t RP1_PAD_PUE = 1 << 3;
+static const uint32_t RP1_PAD_PDE = 1 << 2;
+// clang-format on
+
+/* Bank 0 has the 28 GPIO pins on the 40-pin header. */
+static const int RP1_N_PINS = 28;
+
+/**
+ * Extension structure for RP1 GPIO. The base points at IO_BANK0, and the
+ * mapping must extend over the RIO and PADS blocks that follow it, as the
+ * /dev/gpiomem0 window does.
+ *
+ * Like the BCM2835 driver, this keeps shadows of the configuration registers,
+ * loaded by rp1_gpio_init(), so only registers whose values change are
+ * written.
+ */
 typedef struct {
   volatile uint32_t *base;
+
+  uint32_t ctrl[28];
+  uint32_t pads[28];
+  uint32_t oe;
 } rp1_gpio_ext_t;
 
 /**
  * Initialize the RP1 GPIO data structure.
  *
  * @param[in] gpio The GPIO data structure
- * @param[in] base Pointer to the RP1 GPIO registers.
+ * @param[in] base Pointer to the RP1 IO_BANK0 registers.
  * @return GPIO_SUCCESS on success.
  */
 int rp1_gpio_init(gpio_t *gpio, rp1_gpio_ext_t *ext);
@@ -117,16 +163,39 @@ int rp1_gpio_init(gpio_t *gpio, rp1_gpio_ext_t *ext);
 int rp1_gpio_close(gpio_t *gpio);
 
 /**
- * Set the GPIO pin functions.
+ * Set the GPIO pin functions. IN and OUT select the RIO function, and set
+ * the output enables with one store to the RIO_OE SET or CLR alias.
  *
  * @param[in] gpio The GPIO data structure
  * @param[in] pins The mask of pins whose function to change.
  * @param[in] value The function to assign to the pins.
  * @return GPIO_SUCCESS on success.
  */
+int rp1_gpio_set_function_bits(gpio_t *gpio, uint64_t pins,
+                               pin_function_t value);
+
+/**
+ * Set the GPIO pin functions.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The list of pins whose function to be changed.
+ * @param[in] n The number of elements in the pins list.
+ * @param[in] value The function to assign to the pins.
+ * @return GPIO_SUCCESS on success.
+ */
 int rp1_gpio_set_function_pins(gpio_t *gpio, pin_t *pins, size_t n,
                                pin_function_t value);
 
+/**
+ * Set the internal pullup / pulldown state of the GPIO pins.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The mask of pins whose pullup/down configuration will change.
+ * @param[in] value The pullup/pulldown value to apply to the pins.
+ * @return GPIO_SUCCESS on success.
+ */
+int rp1_gpio_set_pull_bits(gpio_t *gpio, uint64_t pins, pull_control_t value);
+
 /**
  * Set the internal pullup / pulldown state of the GPIO pins.
  *
@@ -139,6 +208,16 @@ int rp1_gpio_set_function_pins(gpio_t *gpio, pin_t *pins, size_t n,
 int rp1_gpio_set_pull_pins(gpio_t *gpio, pin_t *pins, size_t n,
                            pull_control_t value);
 
+/**
+ * Set or clear GPIO bits with one store to the RIO_OUT SET or CLR alias.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] pins The mask of GPIO bits to set or clear.
+ * @param[in] value if zero, clear the bits, otherwise set the bits.
+ * @return GPIO_SUCCESS on success.
+ */
+int rp1_gpio_set_bits(gpio_t *gpio, uint64_t pins, char value);
+
 /**
  * Set or clear GPIO bits.
  *
@@ -150,6 +229,26 @@ int rp1_gpio_set_pull_pins(gpio_t *gpio, pin_t *pins, size_t n,
  */
 int rp1_gpio_set_pins(gpio_t *gpio, pin_t *pins, size_t n, char value);
 
+/**
+ * Set and clear GPIO bits with one store each to the RIO SET and CLR aliases.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[in] set_pins The mask of GPIO bits to set.
+ * @param[in] clear_pins The mask of GPIO bits to clear.
+ * @return GPIO_SUCCESS on success.
+ */
+int rp1_gpio_write_masked(gpio_t *gpio, uint64_t set_pins,
+                          uint64_t clear_pins);
+
+/**
+ * Get the values of the GPIO bits, with one load of RIO_SYNC_IN.
+ *
+ * @param[in] gpio The GPIO data structure
+ * @param[out] values The values of the GPIO pins.
+ * @return GPIO_SUCCESS on success.
+ */
+int rp1_gpio_get_bits(gpio_t *gpio, uint64_t *values);
+
 /**
  * Get the values of the GPIO bits.
  *